@@ -6,9 +6,23 @@
 #include <unordered_map>
 #include <filesystem>
 #include <vector>
+#include <sstream>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include "../Tools/trace.h"
 
 namespace fs = std::filesystem;
 
+#define REGISTER_LOCALS (4)     // calling convention shared with the translator: local 0-3 of eligible functions live in registers
+#define LOOP_WEIGHT (8)         // an access one loop deeper counts this many times more when ranking locals
+#define TEMP_SLOTS (8)
+#define ADDRESS_TEMPS (2)       // temp 2-7 can keep array addresses between calls; the compiler's own scratch is temp 0-1
+#define CALL_WEIGHT (10)        // a call to a pure OS function counts as this many commands when weighing a rewrite
+#define PACKED_BOOLEANS (15)    // per word with --pack; bit 15 would need a constant the VM cannot push
+#define CACHE_MAGIC "jack-compiler-cache 2"     // first line of .compiler_cache, bumped when its layout changes
+
 enum tokenType{
     KEYWORD,
     SYMBOL,
@@ -52,6 +66,22 @@ enum varKind{
 
 std::unordered_map <std::string, keywordType> keyword_map;
 
+static uint64_t contentHash(const std::string& content){    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : content){
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string readFile(const std::string& filename){
+    std::ifstream infile(filename, std::ios::binary);
+    std::stringstream content;
+    content << infile.rdbuf();
+    return content.str();
+}
+
 static inline bool isKeywordConstant(const std::string& keyword){
     if (keyword == "true" || keyword == "false" || keyword == "null" || keyword == "this")      return true;
     return false;
@@ -111,7 +141,7 @@ static inline void initKeywordMap(){
 
 class tokenizer{
     public:
-        tokenizer(const std::string& filename){
+        tokenizer(const std::string& filename) : m_filename(filename){
             m_infile.open(filename);
             if (!m_infile.is_open()){
                 std::exit(1);
@@ -135,21 +165,23 @@ class tokenizer{
         }
 
         void advance(){
+            TRACE_SCOPE("tokenizer::advance");
             if (hasMoreTokens()){
                 resetFields();
                 char temp_token;
-                if (m_backup_token == '\0')         m_infile.get(temp_token);
+                if (m_backup_token == '\0')         read(temp_token);
                 else {
                     temp_token = m_backup_token;
                     m_backup_token = '\0';
                 }
-                while (hasMoreTokens() && std::isspace(temp_token))        m_infile.get(temp_token);          // skip white spaces and new lines
-                
+                while (hasMoreTokens() && std::isspace(temp_token))        read(temp_token);          // skip white spaces and new lines
+                m_token_line = m_line;
+
                 if (isalpha(temp_token)){   // either a keyword or an identifier
                     std::string word; 
                     while (!std::isspace(temp_token) && (isalpha(temp_token) || isdigit(temp_token) || temp_token == '_')){
                         word += temp_token;
-                        m_infile.get(temp_token);
+                        read(temp_token);
                     }
                     m_backup_token = temp_token;
                     if (keyword_map.find(word) != keyword_map.end()){
@@ -165,7 +197,7 @@ class tokenizer{
                     std::string word;
                     while (!std::isspace(temp_token) && isdigit(temp_token)){
                         word += temp_token;
-                        m_infile.get(temp_token);
+                        read(temp_token);
                     }
                     m_backup_token = temp_token;
                     m_current_token_type = INT_CONST;
@@ -173,30 +205,32 @@ class tokenizer{
                 }
                 else if (temp_token == '"'){
                     std::string word;
-                    m_infile.get(temp_token);
+                    read(temp_token);
                     while (temp_token != '"'){
+                        if (!m_infile)  unterminated("string");
                         word += temp_token;
-                        m_infile.get(temp_token);
+                        read(temp_token);
                     }
                     m_current_token_type = STRING_CONST;
                     m_string_val = word;
                 }
                 else if (temp_token == '/'){
-                    m_infile.get(m_backup_token);
+                    read(m_backup_token);
                     if (m_backup_token == '/'){
                         while (temp_token != '\n'){
-                            m_infile.get(temp_token);
+                            read(temp_token);
                         }
                         m_backup_token = '\0';
                         m_current_token_type = INVALID;
                     }
                     else if (m_backup_token == '*'){
                         std::string comment_end = "*/", t_str("  ");
-                        m_infile.get(t_str[0]);
-                        m_infile.get(t_str[1]);
+                        read(t_str[0]);
+                        read(t_str[1]);
                         while (t_str != comment_end){
+                            if (!m_infile)  unterminated("comment");
                             t_str[0] = t_str[1];
-                            m_infile.get(t_str[1]);
+                            read(t_str[1]);
                         }
                         m_backup_token = '\0';
                         m_current_token_type = INVALID;
@@ -239,8 +273,24 @@ class tokenizer{
             return m_current_keyword_or_identifier;
         }
 
+        int line(){     // of the current token
+            return m_token_line;
+        }
+
     private:
+        void read(char& ch){
+            m_infile.get(ch);
+            if (ch == '\n' && m_infile)      ++m_line;
+        }
+
+        void unterminated(const std::string& what){     // thrown rather than exiting, so a watching toolchain survives a half saved file
+            throw std::runtime_error(m_filename + ": line " + std::to_string(m_token_line) + ": unterminated " + what);
+        }
+
+        std::string         m_filename;
         std::ifstream       m_infile;
+        int                 m_line = 1;
+        int                 m_token_line = 1;
         tokenType           m_current_token_type;
         std::string         m_string_val;
         char                m_symbol;
@@ -297,6 +347,10 @@ class symbolTable{
         int indexOf(const std::string& name){
             return m_var_index[name];
         }
+
+        void setIndex(const std::string& name, int index){     // for a layout decided after the declarations
+            m_var_index[name] = index;
+        }
     private:
         std::unordered_map <std::string, std::string>           m_var_type;
         std::unordered_map <std::string, varKind>               m_var_kind;
@@ -304,9 +358,44 @@ class symbolTable{
         std::unordered_map <varKind, int>                       m_running_index;    
 };
 
+enum vmOp{
+    VM_PUSH,
+    VM_POP,
+    VM_ARITHMETIC,
+    VM_LABEL,
+    VM_GOTO,
+    VM_IF,
+    VM_CALL,
+    VM_FUNCTION,
+    VM_RETURN
+};
+
+struct vmCommand{
+    vmOp            op;
+    std::string     arg1;       // segment, arithmetic command, label or function name
+    int             arg2;       // index, argument count or local count
+    int             line = 0;   // Jack source line it was compiled from
+};
+
+std::string toString(const vmCommand& command){
+    switch (command.op)
+    {
+        case VM_PUSH:           return "push " + command.arg1 + " " + std::to_string(command.arg2);
+        case VM_POP:            return "pop " + command.arg1 + " " + std::to_string(command.arg2);
+        case VM_ARITHMETIC:     return command.arg1;
+        case VM_LABEL:          return "label " + command.arg1;
+        case VM_GOTO:           return "goto " + command.arg1;
+        case VM_IF:             return "if-goto " + command.arg1;
+        case VM_CALL:           return "call " + command.arg1 + " " + std::to_string(command.arg2);
+        case VM_FUNCTION:       return "function " + command.arg1 + " " + std::to_string(command.arg2);
+        default:                return "return";
+    }
+}
+
 class VMWriter{
     public:
-        VMWriter(const std::string& filename){
+        VMWriter(const std::string& filename, bool in_memory) : m_filename(filename), m_in_memory(in_memory){
+            if (in_memory)      return;
             std::string fname = filename.substr(0, filename.size() - 5) + ".vm";
             m_outfile.open(fname);
             if (!m_outfile.is_open()){
@@ -315,68 +404,176 @@ class VMWriter{
         }
 
         ~VMWriter(){
+            if (m_outfile.is_open())    TRACE_COUNT("vm bytes written", m_outfile.tellp());
             m_outfile.close();
         }
 
         void writePush(const std::string& segment, int index){
-            m_outfile << "push " << segment << " " << index << "\n";
+            write({VM_PUSH, segment, index});
         }
 
         void writePop(const std::string& segment, int index){
-            m_outfile << "pop " << segment << " " << index << "\n";
+            write({VM_POP, segment, index});
         }
 
         void writeArithmetic(const std::string& command){
-            m_outfile << command << "\n";
+            write({VM_ARITHMETIC, command, 0});
         }
 
         void writeLabel(const std::string& label){
-            m_outfile << "label " << label << "\n";
+            write({VM_LABEL, label, 0});
         }
 
         void writeGoto(const std::string& label){
-            m_outfile << "goto " << label << "\n";
+            write({VM_GOTO, label, 0});
         }
 
         void writeIf(const std::string& label){
-            m_outfile << "if-goto " << label << "\n";
+            write({VM_IF, label, 0});
         }
 
         void writeCall(const std::string& name, int n_args){
-            m_outfile << "call " << name << " " << n_args << "\n";
+            write({VM_CALL, name, n_args});
         }
 
         void writeFunction(const std::string& name, int n_vars){
-            m_outfile << "function " << name << " " << n_vars << "\n";
+            write({VM_FUNCTION, name, n_vars});
         }
 
         void writeReturn(){
-            m_outfile << "return\n";
+            write({VM_RETURN, "", 0});
+        }
+
+        void setLine(int line){
+            m_line = line;
+        }
+
+        void openMap(){     // source map: the .jack file name, then the Jack line of every VM line that follows
+            m_mapfile.open(m_filename.substr(0, m_filename.size() - 5) + ".vm.map");
+            if (!m_mapfile.is_open()){
+                std::exit(1);
+            }
+            m_mapfile << fs::path(m_filename).filename().string() << "\n";
+        }
+
+        void setBuffered(bool buffered){    // hold commands back until flush() so a whole subroutine can be rewritten
+            m_buffered = buffered;
         }
+
+        std::vector<vmCommand>& buffer(){
+            return m_buffer;
+        }
+
+        void flush(){
+            for (const vmCommand& command : m_buffer)   emit(command);
+            m_buffer.clear();
+        }
+
+        const std::vector<vmCommand>& commands() const {   // everything written so far when kept in memory
+            return m_commands;
+        }
+
+        std::vector<vmCommand> takeCommands(){
+            std::vector<vmCommand> commands;
+            commands.swap(m_commands);
+            return commands;
+        }
+
     private:
+        void write(vmCommand command){
+            command.line = m_line;
+            if (m_buffered)     m_buffer.push_back(command);
+            else                emit(command);
+        }
+
+        void emit(const vmCommand& command){
+            TRACE_COUNT("vm commands written", 1);
+            if (m_in_memory)    m_commands.push_back(command);
+            else                m_outfile << toString(command) << "\n";
+            if (m_mapfile.is_open())    m_mapfile << command.line << "\n";
+        }
+
+        std::string                 m_filename;
         std::ofstream               m_outfile;
+        std::ofstream               m_mapfile;
+        int                         m_line = 0;
+        bool                        m_in_memory;
+        bool                        m_buffered = false;
+        std::vector<vmCommand>      m_buffer;
+        std::vector<vmCommand>      m_commands;
+};
+
+struct arrayAccess{     // an element read or store among a subroutine's VM commands, for compileEngine::reuseThat
+    int                 pointer;            // its "pop pointer 1"
+    bool                store;
+    int                 address_start;      // the commands computing the element address
+    int                 value_start;        // and the stored value, up to "pop temp 0"; the pointer for a read
+    bool                reorder = false;    // a store whose value can be computed ahead of its address
+    bool                that_hit = false;   // THAT already holds the address
+    int                 group = -1;         // accesses computing the same address with no call in between
+};
+
+struct pureFunction{    // an OS function without side effects, whose calls --optimize may move or share
+    bool                may_fail;       // calls Sys.error for some arguments, so it never runs earlier than written
+    bool                reads_memory;   // the result also depends on the heap, not just on the arguments
+};
+
+const std::unordered_map<std::string, pureFunction> pure_functions{
+    {"Math.abs", {false, false}},
+    {"Math.multiply", {false, false}},
+    {"Math.divide", {true, false}},
+    {"Math.min", {false, false}},
+    {"Math.max", {false, false}},
+    {"Math.sqrt", {true, false}},
+    {"String.length", {false, true}},
+    {"String.charAt", {true, true}},
+    {"String.intValue", {false, true}},
+    {"String.backSpace", {false, false}},
+    {"String.doubleQuote", {false, false}},
+    {"String.newLine", {false, false}},
+    {"Memory.peek", {false, true}},
+};
+
+struct vmEffects{       // what a stretch of VM commands may change, for compileEngine::optimize
+    std::vector<std::pair<std::string, int>>    pops;           // segment and index of every pop
+    bool                                        heap = false;   // a store to a field or an array element
+    bool                                        calls = false;  // a call that is not to a pure function
+};
+
+struct packedField{     // a boolean or char field sharing a word of the object with others
+    int                 word;
+    int                 bit;        // boolean: its bit, 0 to 14; char: 0 for the low byte, 8 for the high one
+    bool                is_char;
 };
 
 class compileEngine{
     public:
-        compileEngine(const std::string& filename) : m_tokenizer(filename), m_writer(filename){
+        compileEngine(const std::string& filename, bool use_registers, bool in_memory = false)
+            : m_tokenizer(filename), m_writer(filename, in_memory), m_use_registers(use_registers){
+            m_writer.setBuffered(use_registers);
             do {
                 m_tokenizer.advance();
             }
-            while (m_tokenizer.currentTokenType() == INVALID);
+            while (m_tokenizer.currentTokenType() == INVALID && m_tokenizer.hasMoreTokens());
         }
 
         void process(){
+            m_writer.setLine(m_tokenizer.line());   // code emitted from here on belongs to the token just consumed
             do {
                 m_tokenizer.advance();
             }
-            while (m_tokenizer.currentTokenType() == INVALID);
+            while (m_tokenizer.currentTokenType() == INVALID && m_tokenizer.hasMoreTokens());     // a trailing comment must not spin at end of file
+            TRACE_COUNT("tokens", 1);
         }
 
         void compileClass(){    
+            TRACE_SCOPE("compileEngine::compileClass");
             m_if_label_index = 0;
             m_while_label_index = 0;
             m_field_count = 0;
+            m_static_count = 0;
+            m_fields.clear();
+            m_packed_fields.clear();
             process();          // "class"
             m_class_name = m_tokenizer.keywordOrIdentifier();
             process();          // class name
@@ -384,6 +581,7 @@ class compileEngine{
             while (m_tokenizer.keyword() == _STATIC || m_tokenizer.keyword() == _FIELD){
                 compileClassVarDec();   
             }
+            layoutFields();
             while (m_tokenizer.currentTokenType() == KEYWORD && (m_tokenizer.keyword() == _CONSTRUCTOR || m_tokenizer.keyword() == _FUNCTION || m_tokenizer.keyword() == _METHOD)){
                 compileSubroutine();
             }
@@ -391,6 +589,7 @@ class compileEngine{
         }
 
         void compileClassVarDec(){     
+            TRACE_SCOPE("compileEngine::compileClassVarDec");
             varKind var_kind;
             if (m_tokenizer.keywordOrIdentifier() == "static")      var_kind = VAR_STATIC;
             else                                                    var_kind = VAR_FIELD;
@@ -398,20 +597,82 @@ class compileEngine{
             m_var_type = m_tokenizer.keywordOrIdentifier();
             process();     // var type
             m_var_name = m_tokenizer.keywordOrIdentifier();
-            m_class_symbol_table.define(m_var_name, m_var_type, var_kind);
+            defineClassVar(var_kind);
             process();     // var name
-            ++m_field_count;
             while (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() == ','){
                 process();  // ","
                 m_var_name = m_tokenizer.keywordOrIdentifier();
-                m_class_symbol_table.define(m_var_name, m_var_type, var_kind);
+                defineClassVar(var_kind);
                 process();  // var name
-                ++m_field_count;
             }
             process();      // ";"
         }
 
+        void defineClassVar(varKind var_kind){
+            m_class_symbol_table.define(m_var_name, m_var_type, var_kind);
+            if (var_kind == VAR_FIELD)      m_fields.push_back({m_var_name, m_var_type});
+            else                            ++m_static_count;
+        }
+
+        void setPackFields(bool pack){
+            m_pack_fields = pack;
+        }
+
+        void setReuseThat(bool reuse){
+            m_reuse_that = reuse;
+            m_writer.setBuffered(rewrites());
+        }
+
+        void setOptimize(bool optimize){
+            m_optimize = optimize;
+            m_writer.setBuffered(rewrites());
+        }
+
+        void setTailCalls(bool tail_calls){
+            m_tail_calls = tail_calls;
+            m_writer.setBuffered(rewrites());
+        }
+
+        bool rewrites() const {     // whether any pass rewrites a subroutine before it is written
+            return m_use_registers || m_reuse_that || m_optimize || m_tail_calls;
+        }
+
+        // only fields take space in an object. With packing, booleans share words 15 to a word and chars
+        // two to a word after the other fields, which keep their declaration order; field access code
+        // then goes through pushVariable() and popVariable()
+        void layoutFields(){
+            int words = 0;
+            for (const auto& field : m_fields){
+                if (m_pack_fields && (field.second == "boolean" || field.second == "char"))     continue;
+                m_class_symbol_table.setIndex(field.first, words++);
+            }
+            if (m_pack_fields){
+                int booleans = 0, chars = 0;
+                for (const auto& field : m_fields){
+                    if (field.second == "boolean"){
+                        m_packed_fields[field.first] = {words + booleans / PACKED_BOOLEANS, booleans % PACKED_BOOLEANS, false};
+                        ++booleans;
+                    }
+                }
+                words += (booleans + PACKED_BOOLEANS - 1) / PACKED_BOOLEANS;
+                for (const auto& field : m_fields){
+                    if (field.second == "char"){
+                        m_packed_fields[field.first] = {words + chars / 2, chars % 2 * 8, true};
+                        ++chars;
+                    }
+                }
+                words += (chars + 1) / 2;
+            }
+            if (m_pack_fields && !m_fields.empty()){
+                std::cout << "layout " << m_class_name << ": " << words << " word(s) per object, "
+                          << m_fields.size() + m_static_count - words << " saved (" << m_static_count << " static, "
+                          << m_fields.size() - words << " packed)\n";
+            }
+            m_field_count = words;
+        }
+
         void compileParameter(){        
+            TRACE_SCOPE("compileEngine::compileParameter");
             ++m_param_count;
             m_var_type = m_tokenizer.keywordOrIdentifier();
             process();      // type
@@ -421,6 +682,7 @@ class compileEngine{
         }
 
         void compileSubroutine(){       
+            TRACE_SCOPE("compileEngine::compileSubroutine");
             m_is_method = false;
             m_is_constructor = false;
             m_is_void_function = false;
@@ -443,10 +705,414 @@ class compileEngine{
             process();      // "("
             compileParameterList();
             process();      // ")"      
+            m_interface.push_back(m_current_function_name + " " + std::to_string(m_param_count + (m_is_method ? 1 : 0)));
             compileSubroutineBody();               
+            if (m_tail_calls)       tailCalls();
+            if (m_optimize)         optimize();
+            if (m_reuse_that)       reuseThat();
+            if (m_use_registers)    rankLocals();
+            m_writer.flush();
+            if (m_on_subroutine)    m_on_subroutine(m_writer.takeCommands());
+        }
+
+        void writeMap(){
+            m_writer.openMap();
+        }
+
+        void onSubroutine(std::function<void(std::vector<vmCommand>&&)> sink){     // hand over each subroutine as soon as it is compiled
+            m_on_subroutine = sink;
+        }
+
+        void rankLocals(){     // renumber locals so the most used ones (weighted by loop depth) land in register slots
+            if (m_var_count <= REGISTER_LOCALS)     return;     // every local already gets a register
+            std::vector<vmCommand>& commands = m_writer.buffer();
+            std::vector<long> weights(m_var_count, 0);
+            long weight = 1;
+            for (const vmCommand& command : commands){
+                if (command.op == VM_LABEL && command.arg1.rfind("LOOP_START_", 0) == 0)       weight *= LOOP_WEIGHT;
+                else if (command.op == VM_LABEL && command.arg1.rfind("LOOP_END_", 0) == 0)    weight /= LOOP_WEIGHT;
+                else if ((command.op == VM_PUSH || command.op == VM_POP) && command.arg1 == "local"){
+                    weights[command.arg2] += weight;
+                }
+            }
+            std::vector<int> order(m_var_count);
+            for (int i = 0; i < m_var_count; i++)      order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&weights](int a, int b){ return weights[a] > weights[b]; });
+            std::vector<int> new_index(m_var_count);
+            for (int i = 0; i < m_var_count; i++)      new_index[order[i]] = i;
+            for (vmCommand& command : commands){
+                if ((command.op == VM_PUSH || command.op == VM_POP) && command.arg1 == "local"){
+                    command.arg2 = new_index[command.arg2];
+                }
+            }
+        }
+
+        // array element addresses through each basic block of the subroutine. A read of the element THAT
+        // already points at drops its address computation, and so does a store to it, which then pops the
+        // value straight into "that 0". An address computed more than once in a straight line, with no call or
+        // branch in between, is kept in a spare temp slot and pushed from there. A store computes its value
+        // before its address wherever that cannot change the address, so the value no longer needs temp 0
+        void reuseThat(){
+            std::vector<vmCommand>& commands = m_writer.buffer();
+            std::vector<arrayAccess> accesses;
+            std::vector<std::vector<vmCommand>> keys;   // the address computation of each group
+            std::vector<std::vector<int>> members;      // the accesses of each group that compute it
+            std::vector<int> open;                      // groups whose address is still the same
+            std::vector<vmCommand> that_key;            // the address computation THAT holds the result of, if any
+            bool that_known = false;
+            for (size_t i = 0; i < commands.size(); i++){
+                const vmCommand& command = commands[i];
+                bool read = isCommand(command, VM_POP, "pointer", 1) && i + 1 < commands.size() && isCommand(commands[i + 1], VM_PUSH, "that", 0);
+                bool store = isCommand(command, VM_POP, "pointer", 1) && i > 0 && i + 2 < commands.size()
+                             && isCommand(commands[i - 1], VM_POP, "temp", 0) && isCommand(commands[i + 1], VM_PUSH, "temp", 0)
+                             && isCommand(commands[i + 2], VM_POP, "that", 0);
+                arrayAccess access;
+                access.pointer = i;
+                access.store = store;
+                access.value_start = store ? expressionStart(commands, i - 2) : (int)i;
+                access.address_start = access.value_start < 0 ? -1 : expressionStart(commands, access.value_start - 1);
+                if ((read || store) && access.address_start >= 0){
+                    std::vector<vmCommand> key(commands.begin() + access.address_start, commands.begin() + access.value_start);
+                    bool cacheable = addressOnly(key), value_calls = false;
+                    for (int k = access.value_start; k < (int)i - 1 && store; k++)     value_calls |= commands[k].op == VM_CALL;
+                    // calls in the value may change statics and fields, and so the address it was meant for
+                    access.reorder = store && cacheable && (!value_calls || !readsMemory(key));
+                    access.that_hit = (read ? cacheable : access.reorder) && that_known && sameCommands(key, that_key);
+                    if (cacheable && !access.that_hit && (read || access.reorder)){
+                        for (int group : open){
+                            if (sameCommands(keys[group], key))     access.group = group;
+                        }
+                        if (access.group < 0){
+                            access.group = keys.size();
+                            keys.push_back(key);
+                            members.push_back({});
+                            open.push_back(access.group);
+                        }
+                        members[access.group].push_back(accesses.size());
+                    }
+                    if (!access.that_hit){
+                        that_key = key;
+                        that_known = cacheable;
+                    }
+                    accesses.push_back(access);
+                    continue;
+                }
+                if (command.op == VM_LABEL || command.op == VM_FUNCTION || command.op == VM_RETURN){
+                    that_known = false;
+                    open.clear();
+                }
+                else if (command.op == VM_CALL){    // THAT comes back from a call, the temp slots do not
+                    that_known = that_known && !readsMemory(that_key);
+                    open.clear();
+                }
+                else if (command.op == VM_IF || command.op == VM_GOTO){    // a slot filled here would be paid for on every path, used on one
+                    open.clear();
+                }
+                else if (command.op == VM_POP){
+                    if (isCommand(command, VM_POP, "pointer", 1))   that_known = false;
+                    if (that_known && changesAddress(command, that_key))    that_known = false;
+                    open.erase(std::remove_if(open.begin(), open.end(), [&](int group){ return changesAddress(command, keys[group]); }), open.end());
+                }
+            }
+
+            // temp slots for the groups computing their address more than once, shared by groups that do not overlap
+            std::vector<int> slot(keys.size(), -1);
+            std::vector<int> busy_until(TEMP_SLOTS, -1);
+            for (size_t group = 0; group < keys.size(); group++){
+                if (members[group].size() < 2)  continue;
+                int first = accesses[members[group].front()].address_start, last = accesses[members[group].back()].pointer;
+                for (int t = ADDRESS_TEMPS; t < TEMP_SLOTS && slot[group] < 0; t++){
+                    if (busy_until[t] < first){
+                        slot[group] = t;
+                        busy_until[t] = last;
+                    }
+                }
+            }
+
+            std::vector<bool> skip(commands.size(), false);
+            std::vector<std::vector<vmCommand>> before(commands.size());     // commands put in ahead of one
+            for (const arrayAccess& access : accesses){
+                int t = access.group < 0 ? -1 : slot[access.group];
+                if (access.store ? !access.reorder : !access.that_hit && t < 0)     continue;   // left as it is
+                for (int k = access.address_start; k < access.value_start; k++)     skip[k] = true;
+                if (access.store){
+                    skip[access.pointer - 1] = skip[access.pointer + 1] = true;    // pop temp 0, push temp 0
+                }
+                if (access.that_hit){
+                    skip[access.pointer] = true;
+                    continue;
+                }
+                std::vector<vmCommand>& address = before[access.store ? access.pointer - 1 : access.pointer];
+                int line = commands[access.value_start - 1].line;
+                if (t >= 0 && members[access.group].front() != (int)(&access - &accesses[0])){
+                    address.push_back({VM_PUSH, "temp", t, line});
+                    continue;
+                }
+                address.insert(address.end(), commands.begin() + access.address_start, commands.begin() + access.value_start);
+                if (t >= 0){
+                    address.push_back({VM_POP, "temp", t, line});
+                    address.push_back({VM_PUSH, "temp", t, line});
+                }
+            }
+            std::vector<vmCommand> rewritten;
+            for (size_t i = 0; i < commands.size(); i++){
+                rewritten.insert(rewritten.end(), before[i].begin(), before[i].end());
+                if (!skip[i])   rewritten.push_back(commands[i]);
+            }
+            commands.swap(rewritten);
+        }
+
+        static bool changesAddress(const vmCommand& pop, const std::vector<vmCommand>& key){
+            for (const vmCommand& operand : key){
+                if (operand.arg1 == pop.arg1 && operand.arg2 == pop.arg2)                   return true;
+                if ((pop.arg1 == "that" || pop.arg1 == "pointer") && operand.arg1 == "this")  return true;
+            }
+            return false;
+        }
+
+        static bool isCommand(const vmCommand& command, vmOp op, const std::string& arg1, int arg2){
+            return command.op == op && command.arg1 == arg1 && command.arg2 == arg2;
+        }
+
+        static bool sameCommands(const std::vector<vmCommand>& a, const std::vector<vmCommand>& b){
+            if (a.size() != b.size())   return false;
+            for (size_t i = 0; i < a.size(); i++){
+                if (!isCommand(a[i], b[i].op, b[i].arg1, b[i].arg2))    return false;
+            }
+            return true;
+        }
+
+        // the first command of the expression whose value the command at end leaves on the stack, or -1
+        static int expressionStart(const std::vector<vmCommand>& commands, int end){
+            int needed = 1;
+            for (int i = end; i >= 0; i--){
+                const vmCommand& command = commands[i];
+                if (i > 0 && isCommand(command, VM_PUSH, "that", 0) && isCommand(commands[i - 1], VM_POP, "pointer", 1)){
+                    --i;    // an element read turns its address into the element
+                    continue;
+                }
+                if (command.op == VM_PUSH)                  --needed;
+                else if (command.op == VM_POP)              ++needed;
+                else if (command.op == VM_CALL)             needed += command.arg2 - 1;
+                else if (command.op == VM_ARITHMETIC)       needed += (command.arg1 == "neg" || command.arg1 == "not") ? 0 : 1;
+                else                                        return -1;
+                if (needed == 0)    return i;
+            }
+            return -1;
+        }
+
+        static bool addressOnly(const std::vector<vmCommand>& key){     // pushes and arithmetic, no memory behind THAT
+            for (const vmCommand& command : key){
+                if (command.op == VM_ARITHMETIC)    continue;
+                if (command.op != VM_PUSH || command.arg1 == "that" || command.arg1 == "temp" || command.arg1 == "pointer")    return false;
+            }
+            return true;
+        }
+
+        static bool readsMemory(const std::vector<vmCommand>& key){     // anything a called subroutine could change
+            for (const vmCommand& command : key){
+                if (command.op == VM_PUSH && (command.arg1 == "static" || command.arg1 == "this"))    return true;
+            }
+            return false;
+        }
+
+        // "return f(...)" where f is the subroutine itself overwrites the arguments with the new ones, clears
+        // the locals as a call would, and jumps back to the top, so the recursion runs in one frame. Calls to
+        // other subroutines in tail position are left to the translator's --tail-calls
+        void tailCalls(){
+            std::vector<vmCommand>& commands = m_writer.buffer();
+            int n_args = m_param_count + (m_is_method ? 1 : 0), calls = 0;
+            std::string label = "TAIL_CALL_" + m_current_function_name.substr(m_class_name.size() + 1);
+            std::vector<vmCommand> rewritten;
+            for (size_t i = 0; i < commands.size(); i++){
+                bool self_call = !m_is_constructor && isCommand(commands[i], VM_CALL, m_current_function_name, n_args)
+                                 && i + 1 < commands.size() && commands[i + 1].op == VM_RETURN;
+                if (!self_call){
+                    rewritten.push_back(commands[i]);
+                    continue;
+                }
+                int line = commands[i].line;
+                for (int arg = n_args - 1; arg >= 0; arg--)     rewritten.push_back({VM_POP, "argument", arg, line});
+                for (int local = 0; local < m_var_count; local++){
+                    rewritten.push_back({VM_PUSH, "constant", 0, line});
+                    rewritten.push_back({VM_POP, "local", local, line});
+                }
+                rewritten.push_back({VM_GOTO, label, 0, line});
+                ++i;    // the return
+                ++calls;
+            }
+            if (calls == 0)     return;
+            rewritten.insert(rewritten.begin() + 1, {VM_LABEL, label, 0, rewritten[0].line});    // after the function command
+            commands.swap(rewritten);
+            TRACE_COUNT("tail calls", calls);
+        }
+
+        // loop-invariant code motion, then common subexpressions within basic blocks. Only expressions without
+        // side effects move: pushes, arithmetic, element reads and calls in pure_functions. Each one moved or
+        // shared is computed once into a new local, which rankLocals() then ranks like any other
+        void optimize(){
+            std::vector<vmCommand>& commands = m_writer.buffer();
+            int hoisted = 0, shared = 0;
+            while (hoistInvariant(commands))        ++hoisted;
+            while (shareSubexpression(commands))    ++shared;
+            commands[0].arg2 = m_var_count;     // function Name n
+            TRACE_COUNT("expressions hoisted", hoisted);
+            TRACE_COUNT("subexpressions shared", shared);
+        }
+
+        // the costliest expression no command of its loop can change, innermost loops first, goes ahead of the
+        // loop. One that may fail only moves out of the condition, which runs at least once anyway
+        bool hoistInvariant(std::vector<vmCommand>& commands){
+            std::vector<std::pair<int, int>> loops;     // LOOP_START and LOOP_END labels
+            for (size_t start = 0; start < commands.size(); start++){
+                if (commands[start].op != VM_LABEL || commands[start].arg1.rfind("LOOP_START_", 0) != 0)   continue;
+                std::string end_label = "LOOP_END_" + commands[start].arg1.substr(11);
+                for (size_t end = start + 1; end < commands.size(); end++){
+                    if (isCommand(commands[end], VM_LABEL, end_label, 0))   loops.push_back({start, end});
+                }
+            }
+            std::stable_sort(loops.begin(), loops.end(), [](const auto& a, const auto& b){ return a.second - a.first < b.second - b.first; });
+            for (const auto& loop : loops){
+                vmEffects effects = effectsOf(commands, loop.first, loop.second);
+                int condition_end = loop.first;
+                while (!isCommand(commands[condition_end], VM_IF, commands[loop.second].arg1, 0))   ++condition_end;
+                int best_start = -1, best_end = -1, best_cost = 0;
+                for (int end = loop.first + 1; end < loop.second; end++){
+                    int start = expressionStart(commands, end);
+                    if (start <= loop.first)    continue;
+                    int cost = expressionCost(commands, start, end);
+                    if (cost > best_cost && unchangedBy(effects, commands, start, end) && (end < condition_end || !mayFail(commands, start, end))){
+                        best_start = start;
+                        best_end = end;
+                        best_cost = cost;
+                    }
+                }
+                if (best_cost == 0)     continue;
+                std::vector<vmCommand> expression(commands.begin() + best_start, commands.begin() + best_end + 1);
+                int local = m_var_count++;
+                replaceAll(commands, loop.first + 1, loop.second, expression, {VM_PUSH, "local", local, expression.back().line});
+                expression.push_back({VM_POP, "local", local, expression.back().line});
+                commands.insert(commands.begin() + loop.first, expression.begin(), expression.end());
+                return true;
+            }
+            return false;
+        }
+
+        // the expression whose later copies in the same basic block save the most, before anything they read
+        // changes, is kept in a local after its first evaluation. Element addresses are left to reuseThat(),
+        // when it runs, which keeps them in temp slots and needs the store pattern intact
+        bool shareSubexpression(std::vector<vmCommand>& commands){
+            int n = commands.size(), best_end = -1, best_limit = -1, best_saving = 0;
+            std::vector<int> starts(n);
+            std::vector<bool> addresses(n, false);      // the last command of an element address
+            for (int end = 0; end < n; end++)   starts[end] = expressionStart(commands, end);
+            for (int i = 1; i < n && m_reuse_that; i++){
+                if (!isCommand(commands[i], VM_POP, "pointer", 1))  continue;
+                int value_start = isCommand(commands[i - 1], VM_POP, "temp", 0) && i >= 2 ? starts[i - 2] : i;
+                if (value_start > 0)    addresses[value_start - 1] = true;
+            }
+            for (int end = 0; end < n; end++){
+                int start = starts[end];
+                int cost = start < 0 || addresses[end] ? 0 : expressionCost(commands, start, end);
+                if (cost == 0)  continue;
+                int length = end - start + 1, copies = 0, limit = end + 1;
+                vmEffects effects;
+                for (; limit < n && !blockBoundary(commands[limit]); limit++){
+                    addEffects(effects, commands[limit]);
+                    if (!unchangedBy(effects, commands, start, end))    break;
+                    if (starts[limit] == limit - length + 1 && starts[limit] > end
+                        && std::equal(commands.begin() + start, commands.begin() + end + 1, commands.begin() + starts[limit],
+                                      [](const vmCommand& a, const vmCommand& b){ return isCommand(a, b.op, b.arg1, b.arg2); })){
+                        ++copies;
+                    }
+                }
+                int saving = copies * (cost - 1) - 2;   // each copy becomes one push; the first value is popped and pushed back
+                if (saving > best_saving){
+                    best_end = end;
+                    best_limit = limit;
+                    best_saving = saving;
+                }
+            }
+            if (best_saving == 0)   return false;
+            std::vector<vmCommand> expression(commands.begin() + starts[best_end], commands.begin() + best_end + 1);
+            int local = m_var_count++, line = expression.back().line;
+            replaceAll(commands, best_end + 1, best_limit, expression, {VM_PUSH, "local", local, line});
+            commands.insert(commands.begin() + best_end + 1, {{VM_POP, "local", local, line}, {VM_PUSH, "local", local, line}});
+            return true;
+        }
+
+        // replaces every copy of expression within commands[begin, end)
+        static void replaceAll(std::vector<vmCommand>& commands, int begin, int end, const std::vector<vmCommand>& expression, const vmCommand& replacement){
+            int length = expression.size();
+            for (int last = end - 1; last - length + 1 >= begin; last--){
+                if (!std::equal(expression.begin(), expression.end(), commands.begin() + last - length + 1,
+                                [](const vmCommand& a, const vmCommand& b){ return isCommand(a, b.op, b.arg1, b.arg2); }))    continue;
+                commands.erase(commands.begin() + last - length + 1, commands.begin() + last + 1);
+                commands.insert(commands.begin() + last - length + 1, replacement);
+                last -= length - 1;
+            }
+        }
+
+        // the weight of commands[start, end] as a value worth keeping in a local: 0 if it has side effects,
+        // reads temp, or is too short to gain anything from
+        static int expressionCost(const std::vector<vmCommand>& commands, int start, int end){
+            int cost = end - start + 1;
+            for (int i = start; i <= end; i++){
+                const vmCommand& command = commands[i];
+                if (i < end && isCommand(command, VM_POP, "pointer", 1) && isCommand(commands[i + 1], VM_PUSH, "that", 0))    ++i;
+                else if (command.op == VM_CALL && pure_functions.count(command.arg1))   cost += CALL_WEIGHT;
+                else if (command.op == VM_PUSH && command.arg1 != "temp" && command.arg1 != "that")     continue;
+                else if (command.op != VM_ARITHMETIC)   return 0;
+            }
+            return cost < 3 ? 0 : cost;
+        }
+
+        static bool mayFail(const std::vector<vmCommand>& commands, int start, int end){
+            for (int i = start; i <= end; i++){
+                if (commands[i].op != VM_CALL || !pure_functions.at(commands[i].arg1).may_fail)      continue;
+                bool constant_divisor = commands[i].arg1 == "Math.divide" && commands[i - 1].op == VM_PUSH
+                                        && commands[i - 1].arg1 == "constant" && commands[i - 1].arg2 != 0;
+                if (!constant_divisor)  return true;
+            }
+            return false;
+        }
+
+        static bool blockBoundary(const vmCommand& command){
+            return command.op == VM_LABEL || command.op == VM_GOTO || command.op == VM_IF || command.op == VM_FUNCTION || command.op == VM_RETURN;
+        }
+
+        static void addEffects(vmEffects& effects, const vmCommand& command){
+            if (command.op == VM_POP){
+                effects.pops.push_back({command.arg1, command.arg2});
+                effects.heap = effects.heap || command.arg1 == "this" || command.arg1 == "that";
+            }
+            else if (command.op == VM_CALL && !pure_functions.count(command.arg1)){
+                effects.calls = effects.heap = true;
+            }
+        }
+
+        static vmEffects effectsOf(const std::vector<vmCommand>& commands, int begin, int end){
+            vmEffects effects;
+            for (int i = begin; i < end; i++)   addEffects(effects, commands[i]);
+            return effects;
+        }
+
+        static bool unchangedBy(const vmEffects& effects, const std::vector<vmCommand>& commands, int start, int end){
+            auto popped = [&effects](const std::string& segment, int index){
+                return std::find(effects.pops.begin(), effects.pops.end(), std::make_pair(segment, index)) != effects.pops.end();
+            };
+            for (int i = start; i <= end; i++){
+                const vmCommand& command = commands[i];
+                if (command.op == VM_PUSH && command.arg1 != "constant" && popped(command.arg1, command.arg2))  return false;
+                if (command.op == VM_PUSH && command.arg1 == "static" && effects.calls)     return false;
+                if (command.op == VM_PUSH && (command.arg1 == "this" || command.arg1 == "that") && (effects.heap || popped("pointer", 0)))     return false;
+                if (command.op == VM_CALL && pure_functions.at(command.arg1).reads_memory && effects.heap)     return false;
+            }
+            return true;
         }
 
         void compileParameterList(){        
+            TRACE_SCOPE("compileEngine::compileParameterList");
             if (m_tokenizer.currentTokenType() != SYMBOL){
                 compileParameter();
                 while (m_tokenizer.symbol() == ','){
@@ -457,6 +1123,7 @@ class compileEngine{
         }
 
         void compileSubroutineBody(){       
+            TRACE_SCOPE("compileEngine::compileSubroutineBody");
             process();      // "{"
             while (m_tokenizer.currentTokenType() == KEYWORD && m_tokenizer.keywordOrIdentifier() == "var"){
                 compileVarDec();
@@ -476,6 +1143,7 @@ class compileEngine{
         }
 
         void compileVarDec(){       
+            TRACE_SCOPE("compileEngine::compileVarDec");
             ++m_var_count;
             process();      // "var"
             m_var_type = m_tokenizer.keywordOrIdentifier();
@@ -494,6 +1162,7 @@ class compileEngine{
         }
 
         void compileStatements(){       
+            TRACE_SCOPE("compileEngine::compileStatements");
             while (m_tokenizer.currentTokenType() == KEYWORD && (m_tokenizer.keyword() == _LET || m_tokenizer.keyword() == _IF 
                     || m_tokenizer.keyword() == _WHILE || m_tokenizer.keyword() == _DO || m_tokenizer.keyword() == _RETURN)){
                 if (m_tokenizer.keyword() == _LET)          compileLet();
@@ -505,12 +1174,13 @@ class compileEngine{
         }
 
         void compileLet(){  
+            TRACE_SCOPE("compileEngine::compileLet");
             process();      // "let"
             std::string identifer_name{m_tokenizer.keywordOrIdentifier()};
             process();      // name
             bool is_array = false;
             if (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() == '['){
-                m_writer.writePush(getMemorySegment(identifer_name), getVarIndex(identifer_name));
+                pushVariable(identifer_name);
                 process();  // "["
                 compileExpression();
                 process();  // "]"
@@ -526,12 +1196,13 @@ class compileEngine{
                 m_writer.writePop("that", 0);
             }
             else {
-                m_writer.writePop(getMemorySegment(identifer_name), getVarIndex(identifer_name));
+                popVariable(identifer_name);
             }
             process();  // ";"
         }
 
         void compileIf(){   
+            TRACE_SCOPE("compileEngine::compileIf");
             std::string label1{"IF_TRUE_" + std::to_string(m_if_label_index)};
             std::string label2{"IF_FALSE_" + std::to_string(m_if_label_index)};
             ++m_if_label_index;
@@ -556,6 +1227,7 @@ class compileEngine{
         }
 
         void compileWhile(){    
+            TRACE_SCOPE("compileEngine::compileWhile");
             std::string label1{"LOOP_START_" + std::to_string(m_while_label_index)};
             std::string label2{"LOOP_END_" + std::to_string(m_while_label_index)};
             ++m_while_label_index;
@@ -574,6 +1246,7 @@ class compileEngine{
         }
 
         void compileDo(){   
+            TRACE_SCOPE("compileEngine::compileDo");
             process();      // do
             compilesubroutineCall();
             process();      // ";"
@@ -581,6 +1254,7 @@ class compileEngine{
         }
 
         void compileReturn(){   
+            TRACE_SCOPE("compileEngine::compileReturn");
             process();      // return
             if (m_tokenizer.currentTokenType() != SYMBOL || (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() != ';')){
                 compileExpression();
@@ -591,6 +1265,7 @@ class compileEngine{
         }
 
         void compileExpression(){       
+            TRACE_SCOPE("compileEngine::compileExpression");
             compileTerm();
             while (m_tokenizer.currentTokenType() == SYMBOL && isOp(m_tokenizer.symbol())){
                 char symbol = m_tokenizer.symbol();
@@ -613,6 +1288,7 @@ class compileEngine{
         }
 
         void compileTerm(){
+            TRACE_SCOPE("compileEngine::compileTerm");
             if (m_tokenizer.currentTokenType() == INT_CONST){
                 m_writer.writePush("constant", m_tokenizer.intVal());
                 process();      // int constant
@@ -644,7 +1320,7 @@ class compileEngine{
                 std::string identifier_name{m_tokenizer.keywordOrIdentifier()};
                 process();      // identifier
                 if (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() == '['){
-                    m_writer.writePush(getMemorySegment(identifier_name), getVarIndex(identifier_name));
+                    pushVariable(identifier_name);
                     process();  // "["
                     compileExpression();
                     process();  // "]"
@@ -654,12 +1330,12 @@ class compileEngine{
                 }
                 else if (m_tokenizer.currentTokenType() == SYMBOL && (m_tokenizer.symbol() == '(' || m_tokenizer.symbol() == '.')){  // handling subroutine call
                     if (m_tokenizer.symbol() == '('){
+                        m_writer.writePush("pointer", 0);
                         process();      // "("
                         compileExpressionList();
                         process();      // ")"
                         identifier_name = m_class_name + "." + identifier_name;
                         m_expression_count++;
-                        m_writer.writePush("pointer", 0);
                     }
                     else {
                         process();      // "."
@@ -669,7 +1345,7 @@ class compileEngine{
                         if (m_function_symbol_table.kindOf(identifier_name) == VAR_NONE && m_class_symbol_table.kindOf(identifier_name) == VAR_NONE)    is_function = true;
                         if (identifier_name != m_class_name && !is_function){     //method 
                             inc_exp_count = true;
-                            m_writer.writePush(getMemorySegment(identifier_name), getVarIndex(identifier_name));
+                            pushVariable(identifier_name);
                             std::string var_type;
                             if (m_function_symbol_table.kindOf(identifier_name) != VAR_NONE)      var_type = m_function_symbol_table.typeOf(identifier_name);
                             else                                                                  var_type = m_class_symbol_table.typeOf(identifier_name);
@@ -684,10 +1360,10 @@ class compileEngine{
                         process();      // ")"
                         if (inc_exp_count)      ++m_expression_count;
                     }
-                    m_writer.writeCall(identifier_name, m_expression_count);
+                    writeCall(identifier_name, m_expression_count);
                 }
                 else {      // handling variable names only
-                    m_writer.writePush(getMemorySegment(identifier_name), getVarIndex(identifier_name));
+                    pushVariable(identifier_name);
                 }
             }
             else if (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() == '('){
@@ -705,19 +1381,22 @@ class compileEngine{
         }
 
         void compileExpressionList(){       
-            m_expression_count = 0;
+            TRACE_SCOPE("compileEngine::compileExpressionList");
+            int expression_count = 0;      // calls nested in the arguments reuse m_expression_count
             if (m_tokenizer.currentTokenType() != SYMBOL || (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() != ')')){
                 compileExpression();
-                ++m_expression_count;
+                ++expression_count;
                 while (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() == ','){
                     process();      // ","
                     compileExpression();
-                    ++m_expression_count;
+                    ++expression_count;
                 }
             }
+            m_expression_count = expression_count;
         }
 
         void compilesubroutineCall(){
+            TRACE_SCOPE("compileEngine::compilesubroutineCall");
             std::string function_name{m_tokenizer.keywordOrIdentifier()};
             process();  // name
             if (m_tokenizer.currentTokenType() == SYMBOL && m_tokenizer.symbol() == '('){
@@ -735,7 +1414,7 @@ class compileEngine{
                 if (m_function_symbol_table.kindOf(function_name) == VAR_NONE && m_class_symbol_table.kindOf(function_name) == VAR_NONE)    is_function = true;
                 if (function_name != m_class_name && !is_function){     //method 
                     inc_exp_count = true;
-                    m_writer.writePush(getMemorySegment(function_name), getVarIndex(function_name));
+                    pushVariable(function_name);
                     std::string var_type;
                     if (m_function_symbol_table.kindOf(function_name) != VAR_NONE)      var_type = m_function_symbol_table.typeOf(function_name);
                     else                                                                var_type = m_class_symbol_table.typeOf(function_name);
@@ -750,7 +1429,24 @@ class compileEngine{
                 process();      // ")"
                 if (inc_exp_count)      ++m_expression_count;
             }
-            m_writer.writeCall(function_name, m_expression_count);
+            writeCall(function_name, m_expression_count);
+        }
+
+        void writeCall(const std::string& function_name, int n_args){     // user level calls, recorded for the interface check
+            m_calls.push_back(function_name + " " + std::to_string(n_args));
+            m_writer.writeCall(function_name, n_args);
+        }
+
+        const std::vector<vmCommand>& commands() const {
+            return m_writer.commands();
+        }
+
+        const std::vector<std::string>& interface() const {
+            return m_interface;
+        }
+
+        const std::vector<std::string>& calls() const {
+            return m_calls;
         }
 
         std::string getMemorySegment(const std::string& var_name){
@@ -769,17 +1465,103 @@ class compileEngine{
             else                                                                     return m_class_symbol_table.indexOf(var_name);
         }
 
+        const packedField* findPacked(const std::string& var_name){      // locals and arguments shadow fields
+            if (m_function_symbol_table.kindOf(var_name) != VAR_NONE)      return nullptr;
+            auto packed = m_packed_fields.find(var_name);
+            return packed == m_packed_fields.end() ? nullptr : &packed->second;
+        }
+
+        // a packed boolean reads back as true (-1) or false, a char as its byte
+        void pushVariable(const std::string& var_name){
+            const packedField* packed = findPacked(var_name);
+            if (packed == nullptr){
+                m_writer.writePush(getMemorySegment(var_name), getVarIndex(var_name));
+            }
+            else if (!packed->is_char){
+                m_writer.writePush("this", packed->word);
+                m_writer.writePush("constant", 1 << packed->bit);
+                m_writer.writeArithmetic("and");
+                m_writer.writePush("constant", 0);
+                m_writer.writeArithmetic("eq");
+                m_writer.writeArithmetic("not");
+            }
+            else if (packed->bit == 0){
+                m_writer.writePush("this", packed->word);
+                m_writer.writePush("constant", 255);
+                m_writer.writeArithmetic("and");
+            }
+            else {      // no shifts in the VM: the top seven bits by division, the sign bit by a compare
+                m_writer.writePush("this", packed->word);
+                m_writer.writePush("constant", 32512);      // 0x7f00
+                m_writer.writeArithmetic("and");
+                m_writer.writePush("constant", 256);
+                m_writer.writeCall("Math.divide", 2);
+                m_writer.writePush("this", packed->word);
+                m_writer.writePush("constant", 0);
+                m_writer.writeArithmetic("lt");
+                m_writer.writePush("constant", 128);
+                m_writer.writeArithmetic("and");
+                m_writer.writeArithmetic("add");
+            }
+        }
+
+        // the value is on the stack; a packed boolean stores any non zero value as true, a char its low byte
+        void popVariable(const std::string& var_name){
+            const packedField* packed = findPacked(var_name);
+            if (packed == nullptr){
+                m_writer.writePop(getMemorySegment(var_name), getVarIndex(var_name));
+                return;
+            }
+            int mask = packed->is_char ? 255 : 1 << packed->bit;
+            if (!packed->is_char){
+                m_writer.writePush("constant", 0);
+                m_writer.writeArithmetic("eq");
+                m_writer.writeArithmetic("not");
+                m_writer.writePush("constant", mask);
+                m_writer.writeArithmetic("and");
+            }
+            else {
+                m_writer.writePush("constant", 255);
+                m_writer.writeArithmetic("and");
+                for (int i = 0; i < packed->bit; i++){     // times 256 by doubling, for the high byte
+                    m_writer.writePop("temp", 1);
+                    m_writer.writePush("temp", 1);
+                    m_writer.writePush("temp", 1);
+                    m_writer.writeArithmetic("add");
+                }
+            }
+            m_writer.writePush("this", packed->word);
+            if (packed->bit == 8){      // the low byte is kept
+                m_writer.writePush("constant", 255);
+            }
+            else {
+                m_writer.writePush("constant", mask);
+                m_writer.writeArithmetic("not");
+            }
+            m_writer.writeArithmetic("and");
+            m_writer.writeArithmetic("or");
+            m_writer.writePop("this", packed->word);
+        }
+
     private:
         tokenizer           m_tokenizer;
         symbolTable         m_class_symbol_table;
         symbolTable         m_function_symbol_table;
         VMWriter            m_writer;
+        bool                m_use_registers;
         std::string         m_class_name;
         std::string         m_current_function_name;
         bool                m_is_void_function;
         bool                m_is_constructor;
         bool                m_is_method;
-        int                 m_field_count;
+        int                 m_field_count;      // words per object
+        int                 m_static_count;
+        bool                m_pack_fields = false;
+        bool                m_reuse_that = false;
+        bool                m_optimize = false;
+        bool                m_tail_calls = false;
+        std::vector<std::pair<std::string, std::string>>    m_fields;   // name, type in declaration order
+        std::unordered_map<std::string, packedField>        m_packed_fields;
         int                 m_param_count;
         int                 m_var_count;
         std::string         m_var_type;
@@ -787,14 +1569,82 @@ class compileEngine{
         int                 m_expression_count;
         int                 m_if_label_index;
         int                 m_while_label_index;
+        std::vector<std::string>    m_interface;    // "Class.name n_args" for every subroutine declared
+        std::vector<std::string>    m_calls;        // "Class.name n_args" for every subroutine call made
+        std::function<void(std::vector<vmCommand>&&)>  m_on_subroutine;
+};
+
+struct cacheEntry{
+    uint64_t                    hash;           // of the source plus the options it was compiled with
+    std::string                 vm;
+    std::string                 map;            // the .vm.map, when compiled with --map
+    std::vector<std::string>    interface;
+    std::vector<std::string>    calls;
+};
+
+class compileCache{     // on-disk record of the last compilation of every class in a directory
+    public:
+        compileCache(const std::string& filename) : m_filename(filename){
+            std::ifstream infile(filename, std::ios::binary);
+            std::string class_file, magic;
+            if (!std::getline(infile, magic) || magic != CACHE_MAGIC)   return;     // older caches are rebuilt
+            cacheEntry entry;
+            size_t vm_size, map_size, interface_size, calls_size;
+            while (infile >> class_file >> entry.hash >> vm_size >> map_size >> interface_size >> calls_size){
+                infile.get();   // "\n"
+                entry.vm.assign(vm_size, '\0');
+                infile.read(&entry.vm[0], vm_size);
+                entry.map.assign(map_size, '\0');
+                infile.read(&entry.map[0], map_size);
+                entry.interface.assign(interface_size, "");
+                entry.calls.assign(calls_size, "");
+                for (std::string& line : entry.interface)   std::getline(infile, line);
+                for (std::string& line : entry.calls)       std::getline(infile, line);
+                m_entries[class_file] = entry;
+            }
+        }
+
+        const cacheEntry* find(const std::string& class_file, uint64_t hash){
+            auto entry = m_entries.find(class_file);
+            if (entry == m_entries.end() || entry->second.hash != hash)     return nullptr;
+            m_current[class_file] = entry->second;
+            return &entry->second;
+        }
+
+        void store(const std::string& class_file, const cacheEntry& entry){
+            m_current[class_file] = entry;
+        }
+
+        const std::unordered_map<std::string, cacheEntry>& current() const {
+            return m_current;
+        }
+
+        void save(){    // only classes seen in this run are kept, deleted files drop out
+            std::ofstream outfile(m_filename, std::ios::binary);
+            outfile << CACHE_MAGIC << "\n";
+            for (const auto& entry : m_current){
+                outfile << entry.first << " " << entry.second.hash << " " << entry.second.vm.size() << " " << entry.second.map.size() << " "
+                        << entry.second.interface.size() << " " << entry.second.calls.size() << "\n"
+                        << entry.second.vm << entry.second.map;
+                for (const std::string& line : entry.second.interface)    outfile << line << "\n";
+                for (const std::string& line : entry.second.calls)        outfile << line << "\n";
+            }
+        }
+
+    private:
+        std::string                                     m_filename;
+        std::unordered_map<std::string, cacheEntry>     m_entries;
+        std::unordered_map<std::string, cacheEntry>     m_current;
 };
 
 class compiler{
     public:
-        compiler(const std::string& filename){
+        compiler(const std::string& filename, bool use_registers, bool incremental, bool map, bool pack = false, bool reuse_that = false, bool optimize = false, bool tail_calls = false){
             std::vector <std::string> filenames;
+            std::string directory;
             if (filename.substr(filename.size() - 4, 4) == "jack"){
                 filenames.push_back(filename);
+                directory = fs::path(filename).parent_path().string();
             }
             else {
                 std::string ext = ".jack";
@@ -803,21 +1653,121 @@ class compiler{
                         filenames.push_back(fpath.path());
                     }
                 }
+                directory = filename;
             }
+            if (!incremental){
+                for (std::string& fname : filenames){
+                    compileEngine compile_engine(fname, use_registers);
+                    compile_engine.setPackFields(pack);
+                    compile_engine.setReuseThat(reuse_that);
+                    compile_engine.setOptimize(optimize);
+                    compile_engine.setTailCalls(tail_calls);
+                    if (map)    compile_engine.writeMap();
+                    compile_engine.compileClass();
+                }
+                return;
+            }
+
+            compileCache cache((fs::path(directory) / ".compiler_cache").string());
+            int compiled = 0, reused = 0;
             for (std::string& fname : filenames){
-                compileEngine compile_engine(fname);
-                compile_engine.compileClass();
+                std::string class_file = fs::path(fname).filename().string();
+                std::string vm_file = fname.substr(0, fname.size() - 5) + ".vm";
+                uint64_t hash = contentHash(readFile(fname) + (use_registers ? "\n--registers" : "") + (map ? "\n--map" : "") + (pack ? "\n--pack" : "") + (reuse_that ? "\n--reuse-that" : "") + (optimize ? "\n--optimize" : "") + (tail_calls ? "\n--tail-calls" : ""));
+                const cacheEntry* cached = cache.find(class_file, hash);
+                if (cached != nullptr){
+                    if (!fs::exists(vm_file) || readFile(vm_file) != cached->vm){
+                        std::ofstream outfile(vm_file, std::ios::binary);
+                        outfile << cached->vm;
+                    }
+                    if (map && (!fs::exists(vm_file + ".map") || readFile(vm_file + ".map") != cached->map)){
+                        std::ofstream outfile(vm_file + ".map", std::ios::binary);
+                        outfile << cached->map;
+                    }
+                    ++reused;
+                    continue;
+                }
+                cacheEntry entry;
+                entry.hash = hash;
+                {
+                    compileEngine compile_engine(fname, use_registers);
+                    compile_engine.setPackFields(pack);
+                    compile_engine.setReuseThat(reuse_that);
+                    compile_engine.setOptimize(optimize);
+                    compile_engine.setTailCalls(tail_calls);
+                    if (map)    compile_engine.writeMap();
+                    compile_engine.compileClass();
+                    entry.interface = compile_engine.interface();
+                    entry.calls = compile_engine.calls();
+                }   // closes the .vm file
+                entry.vm = readFile(vm_file);
+                if (map)    entry.map = readFile(vm_file + ".map");
+                cache.store(class_file, entry);
+                ++compiled;
+            }
+            checkCalls(cache);
+            cache.save();
+            std::cout << "compiled " << compiled << ", reused " << reused << "\n";
+        }
+
+        // code generation never looks at other classes, so a changed interface does not force dependents
+        // to recompile; their recorded calls are checked against the current interfaces instead
+        void checkCalls(const compileCache& cache){
+            std::unordered_map<std::string, int> declared;
+            std::unordered_map<std::string, bool> project_classes;
+            for (const auto& entry : cache.current()){
+                for (const std::string& subroutine : entry.second.interface){
+                    std::stringstream subroutine_stream(subroutine);
+                    std::string name;
+                    int n_args;
+                    subroutine_stream >> name >> n_args;
+                    declared[name] = n_args;
+                    project_classes[name.substr(0, name.find('.'))] = true;
+                }
+            }
+            for (const auto& entry : cache.current()){
+                for (const std::string& call : entry.second.calls){
+                    std::stringstream call_stream(call);
+                    std::string name;
+                    int n_args;
+                    call_stream >> name >> n_args;
+                    if (project_classes.find(name.substr(0, name.find('.'))) == project_classes.end())     continue;
+                    if (declared.find(name) == declared.end()){
+                        std::cout << entry.first << ": call to undeclared " << name << "\n";
+                    }
+                    else if (declared[name] != n_args){
+                        std::cout << entry.first << ": call to " << name << " with " << n_args << " argument(s), declared with " << declared[name] << "\n";
+                    }
+                }
             }
         }
 };
 
 int main(int argc, char* argv[]){
-    if (argc != 2){ // Impose correct usage
+    bool use_registers = false, incremental = false, map = false, pack = false, reuse_that = false, optimize = false, tail_calls = false;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--registers")          use_registers = true;
+        else if (flag == "--pack")          pack = true;    // boolean and char fields share words
+        else if (flag == "--reuse-that")    reuse_that = true;  // array accesses share the address in THAT
+        else if (flag == "--optimize")      optimize = true;    // hoist loop invariants, share common subexpressions
+        else if (flag == "--tail-calls")    tail_calls = true;  // self-recursion in tail position becomes a jump
+        else if (flag == "--map")           map = true;
+        else if (flag == "--incremental")   incremental = true;
+        else                                argc = 0;
+    }
+    if (argc < 2){ // Impose correct usage
         std::cout << "Incorrect usage\n";
         return 1;
     }
 
     initKeywordMap();
-    compiler new_compiler(argv[1]);
+    try {
+        compiler new_compiler(argv[1], use_registers, incremental, map, pack, reuse_that, optimize, tail_calls);
+    }
+    catch (const std::runtime_error& error){
+        std::cout << error.what() << "\n";
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
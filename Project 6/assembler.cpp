@@ -4,12 +4,22 @@
 #include <cctype>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <bitset>
-
-#define ADDRESS_LEN (15)
+#include <vector>
+#include <deque>
+#include <string_view>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include "../Tools/trace.h"
+
+#define ADDRESS_MASK (0x7fff)
 #define VAR_ADDRESS (16)
-
-static std::unordered_map <std::string, std::string> symbol_table;
+#define UNRESOLVED (0xffff)     // address of a symbol that is referenced but not yet a label or variable
+#define CHUNK_BYTES (1 << 18)   // of source per chunk of the parallel assembler
+#define OBJECT_MAGIC "HACKOBJ"  // first word of a relocatable object, see Encoder::writeObject
 
 enum instruction_type{
             A_INSTRUCTION, 
@@ -18,33 +28,81 @@ enum instruction_type{
             INVALID
         };
 
-void symbolTableInit(){
-    symbol_table["SCREEN"]  = "16384";
-    symbol_table["KBD"]     = "24576";
-    symbol_table["SP"]      = "0";
-    symbol_table["LCL"]     = "1";
-    symbol_table["ARG"]     = "2";
-    symbol_table["THIS"]    = "3";
-    symbol_table["THAT"]    = "4";
-    symbol_table["R0"]      = "0";
-    symbol_table["R1"]      = "1";
-    symbol_table["R2"]      = "2";
-    symbol_table["R3"]      = "3";
-    symbol_table["R4"]      = "4";
-    symbol_table["R5"]      = "5";
-    symbol_table["R6"]      = "6";
-    symbol_table["R7"]      = "7";
-    symbol_table["R8"]      = "8";
-    symbol_table["R9"]      = "9";
-    symbol_table["R10"]     = "10";
-    symbol_table["R11"]     = "11";
-    symbol_table["R12"]     = "12";
-    symbol_table["R13"]     = "13";
-    symbol_table["R14"]     = "14";
-    symbol_table["R15"]     = "15";
-}
+constexpr std::pair<std::string_view, uint16_t> predefined_symbols[] = {
+    {"SCREEN", 16384}, {"KBD", 24576},
+    {"SP", 0}, {"LCL", 1}, {"ARG", 2}, {"THIS", 3}, {"THAT", 4},
+    {"R0", 0}, {"R1", 1}, {"R2", 2}, {"R3", 3}, {"R4", 4}, {"R5", 5}, {"R6", 6}, {"R7", 7},
+    {"R8", 8}, {"R9", 9}, {"R10", 10}, {"R11", 11}, {"R12", 12}, {"R13", 13}, {"R14", 14}, {"R15", 15}
+};
+
+struct symbolKey{
+    mutable std::string_view    name;   // the caller's text while probing, repointed at the interned copy on insert
+
+    bool operator==(const symbolKey& other) const {
+        return name == other.name;
+    }
+};
+
+struct symbolHash{
+    size_t operator()(const symbolKey& key) const {
+        return std::hash<std::string_view>()(key.name);
+    }
+};
+
+typedef std::pair<const symbolKey, uint16_t> symbolEntry;
+
+class symbolTable{      // symbol -> ROM or RAM address, every access a single hash probe
+    public:
+        symbolTable(){
+            reset();
+        }
 
-bool isNumber(const std::string& inst){
+        void reset(){
+            m_addresses.clear();
+            m_names.clear();
+            for (const auto& symbol : predefined_symbols)   m_addresses.emplace(symbolKey{symbol.first}, symbol.second);
+        }
+
+        // the address slot of name, inserted holding initial if name is new; the slot stays valid for the
+        // table's lifetime
+        uint16_t& slot(std::string_view name, uint16_t initial){
+            return entry(name, initial).second;
+        }
+
+        symbolEntry& entry(std::string_view name, uint16_t initial){    // as slot(), with the interned name
+            auto entry = m_addresses.try_emplace(symbolKey{name}, initial);
+            if (entry.second){
+                m_names.emplace_back(name);
+                entry.first->first.name = m_names.back();
+            }
+            return *entry.first;
+        }
+
+        symbolEntry& define(std::string_view name, uint16_t address){      // a label; a later definition wins
+            symbolEntry& label = entry(name, address);
+            label.second = address;
+            return label;
+        }
+
+        const uint16_t* find(std::string_view name) const {     // read only, so any number of threads may look up at once
+            auto entry = m_addresses.find(symbolKey{name});
+            return entry == m_addresses.end() ? nullptr : &entry->second;
+        }
+
+        uint16_t lookupOrAllocate(std::string_view name, int& var_address){
+            uint16_t& address = slot(name, UNRESOLVED);
+            if (address == UNRESOLVED)  address = var_address++;
+            return address;
+        }
+
+    private:
+        std::deque<std::string>                                 m_names;    // never moves, so the keys can point into it
+        std::unordered_map<symbolKey, uint16_t, symbolHash>     m_addresses;
+};
+
+static symbolTable symbol_table;
+
+bool isNumber(std::string_view inst){
     for (char const& c : inst){
         if (std::isdigit(c) == 0){
             return false;
@@ -53,10 +111,40 @@ bool isNumber(const std::string& inst){
     return true;
 }
 
+uint16_t parseNumber(std::string_view digits){
+    uint16_t value = 0;
+    for (char c : digits)   value = value * 10 + (c - '0');
+    return value;
+}
+
+void splitCInstruction(const std::string& instruction, std::string& dest, std::string& comp, std::string& jump){
+    int dest_index = 0, jmp_index = -1;
+    for (int i = 0; i < instruction.size(); i++){
+        if (instruction[i] == '=')        {dest_index = i;}
+        else if (instruction[i] == ';')   {jmp_index = i;}
+    }
+    dest = instruction.substr(0, dest_index);
+    if (jmp_index != -1){   // jmp is present
+        if (dest_index != 0){   // dest is present
+            comp = instruction.substr(dest_index + 1, jmp_index - dest_index);
+        }
+        else {
+            comp = instruction.substr(0, jmp_index - dest_index);
+        }
+        jump = instruction.substr(jmp_index + 1, instruction.size() - jmp_index);
+    }
+    else {      // jmp absent
+        comp = instruction.substr(dest_index + 1, instruction.size() - dest_index);
+    }
+}
+
 class Parser{
     public:
         Parser(const std::string& filename){
             m_infile.open(filename);
+            if (!m_infile.is_open()){
+                std::exit(1);
+            }
         }
 
         ~Parser(){
@@ -72,6 +160,7 @@ class Parser{
             if (hasMoreLines()){
                 do {
                     std::getline(m_infile, m_current_instruction);
+                    ++m_line_number;
                     cleanInstruction();
                 }
                 while (!isValidInstruction() && hasMoreLines());
@@ -98,6 +187,7 @@ class Parser{
         }
         
         void parse(){
+            TRACE_SCOPE("assembler Parser::parse");
             if (m_infile.is_open()){
                 advance();
                 if (isValidInstruction()){
@@ -110,24 +200,7 @@ class Parser{
                         m_symbol = m_current_instruction.substr(1, m_current_instruction.size() - 1);
                     }
                     else {  // figure out the dest, comp and jmp components
-                        int dest_index = 0, jmp_index = -1;
-                        for (int i = 0; i < m_current_instruction.size(); i++){
-                            if (m_current_instruction[i] == '=')        {dest_index = i;}
-                            else if (m_current_instruction[i] == ';')   {jmp_index = i;}
-                        }
-                        m_dest = m_current_instruction.substr(0, dest_index);
-                        if (jmp_index != -1){   // jmp is present
-                            if (dest_index != 0){   // dest is present
-                                m_comp = m_current_instruction.substr(dest_index + 1, jmp_index - dest_index);
-                            }
-                            else {
-                                m_comp = m_current_instruction.substr(0, jmp_index - dest_index);
-                            }
-                            m_jump = m_current_instruction.substr(jmp_index + 1, m_current_instruction.size() - jmp_index);
-                        }
-                        else {      // jmp absent
-                            m_comp = m_current_instruction.substr(dest_index + 1, m_current_instruction.size() - dest_index);
-                        }
+                        splitCInstruction(m_current_instruction, m_dest, m_comp, m_jump);
                     }
                 }
                 else{   // encode the instruction as invalid to avoid any future ops on it; will mostly be the last line of the file
@@ -152,13 +225,18 @@ class Parser{
         void reset(const std::string& filename){    // prepare the parser for the 2nd pass
             m_infile.close();
             m_infile.open(filename);
+            m_line_number = 0;
+        }
+
+        int lineNumber() const {
+            return m_line_number;
         }
 
         instruction_type instructionType() const {
             return m_current_instruction_type;
         }
 
-        std::string symbol() const {
+        const std::string& symbol() const {
             return m_symbol;
         }
 
@@ -182,10 +260,17 @@ class Parser{
         std::string                 m_comp;
         std::string                 m_dest;
         std::string                 m_jump;
+        int                         m_line_number = 0;
 };
 
 class Coder{
     public:
+        Coder(){    // tables only, for encoding in memory
+            initDestTable();
+            initJumpTable();
+            initCompTable();
+        }
+
         Coder(const std::string& filename){
             std::string fname = filename.substr(0, filename.size() - 4);
             fname += ".hack";
@@ -196,6 +281,7 @@ class Coder{
         }
 
         ~Coder(){
+            if (m_outfile.is_open())    TRACE_COUNT("hack bytes written", m_outfile.tellp());
             m_outfile.close();
         }
 
@@ -258,9 +344,18 @@ class Coder{
         }
 
         void write(const std::string& instruction){
+            TRACE_COUNT("hack words written", 1);
             m_outfile << instruction << "\n";
         }
 
+        void writeWord(uint16_t word){
+            TRACE_COUNT("hack words written", 1);
+            char line[17];
+            for (int bit = 0; bit < 16; bit++)  line[bit] = '0' + ((word >> (15 - bit)) & 1);
+            line[16] = '\n';
+            m_outfile.write(line, sizeof(line));
+        }
+
         std::string dest(const std::string& destination){
             return m_destination_table[destination];
         }
@@ -273,52 +368,311 @@ class Coder{
             return m_jump_table[jumpstr];
         }
 
+        // the same text as "111" + comp() + dest() + jump() and a newline, without touching the tables, so
+        // that many threads can share one coder
+        void appendC(std::string& out, const std::string& destination, const std::string& computation, const std::string& jumpstr) const {
+            out += "111";
+            out += field(m_comp_table, computation);
+            out += field(m_destination_table, destination);
+            out += field(m_jump_table, jumpstr);
+            out += '\n';
+        }
+
     private:
+        static const std::string& field(const std::unordered_map<std::string, std::string>& table, const std::string& key){
+            static const std::string none;
+            auto entry = table.find(key);
+            return entry == table.end() ? none : entry->second;
+        }
+
         std::ofstream                                   m_outfile;
         std::unordered_map<std::string, std::string>    m_destination_table;
         std::unordered_map<std::string, std::string>    m_jump_table;
         std::unordered_map<std::string, std::string>    m_comp_table;
 };
 
-int main(int argc, char* argv[]){
-    symbolTableInit();
-    Parser parser(argv[1]);
-    Coder coder(argv[1]);
+class Encoder{  // assembles clean asm lines (no comments or whitespace) held in memory straight to words
+    public:
+        void addLine(const std::string& line){
+            TRACE_SCOPE("Encoder::addLine");
+            if (line.empty())       return;
+            if (line[0] == '('){
+                m_labels.push_back(&m_symbols.define(std::string_view(line).substr(1, line.size() - 2), m_words.size()));
+            }
+            else if (line[0] == '@'){
+                std::string_view symbol = std::string_view(line).substr(1);
+                if (isNumber(symbol))       m_words.push_back(parseNumber(symbol) & ADDRESS_MASK);
+                else {
+                    m_fixups.push_back({m_words.size(), &m_symbols.entry(symbol, UNRESOLVED)});
+                    m_words.push_back(0);
+                }
+            }
+            else {
+                std::string dest, comp, jump;
+                splitCInstruction(line, dest, comp, jump);
+                m_words.push_back(std::bitset<16>("111" + m_coder.comp(comp) + m_coder.dest(dest) + m_coder.jump(jump)).to_ulong());
+            }
+        }
+
+        // labels may be used before they are defined, so symbols are only resolved once every line is in;
+        // walking the references in order hands out variable addresses exactly like the two pass assembler
+        const std::vector<uint16_t>& finish(){
+            TRACE_SCOPE("Encoder::finish");
+            int var_address = VAR_ADDRESS;
+            for (const auto& fixup : m_fixups){
+                if (fixup.second->second == UNRESOLVED)     fixup.second->second = var_address++;
+                m_words[fixup.first] = fixup.second->second & ADDRESS_MASK;
+            }
+            TRACE_COUNT("hack words written", m_words.size());
+            return m_words;
+        }
+
+        // instead of finish(), a relocatable object for the linker: the words, the labels defined here, and
+        // the references it has to patch. A reference to a label of this object already holds the offset and
+        // only needs the object's base added (R); any other symbol is a label of another object or a
+        // variable, resolved by name (S). Predefined symbols are filled in here
+        void writeObject(std::ostream& out){
+            TRACE_SCOPE("Encoder::writeObject");
+            std::unordered_set<std::string_view> local;
+            std::vector<const symbolEntry*> labels;
+            for (const symbolEntry* label : m_labels){
+                if (local.insert(label->first.name).second)     labels.push_back(label);
+            }
+            std::vector<size_t> relative;
+            std::vector<std::pair<size_t, std::string_view>> named;
+            for (const auto& fixup : m_fixups){
+                if (local.count(fixup.second->first.name)){
+                    m_words[fixup.first] = fixup.second->second;
+                    relative.push_back(fixup.first);
+                }
+                else if (fixup.second->second != UNRESOLVED)    m_words[fixup.first] = fixup.second->second & ADDRESS_MASK;
+                else                                            named.push_back({fixup.first, fixup.second->first.name});
+            }
+            out << OBJECT_MAGIC << " " << m_words.size() << " " << labels.size() << " " << relative.size() << " " << named.size() << "\n";
+            for (uint16_t word : m_words)                   out << std::bitset<16>(word) << "\n";
+            for (const symbolEntry* label : labels)         out << "L " << label->first.name << " " << label->second << "\n";
+            for (size_t index : relative)                   out << "R " << index << "\n";
+            for (const auto& reference : named)             out << "S " << reference.first << " " << reference.second << "\n";
+        }
+
+    private:
+        Coder                                           m_coder;
+        std::vector<uint16_t>                           m_words;
+        symbolTable                                     m_symbols;
+        std::vector<std::pair<size_t, symbolEntry*>>    m_fixups;   // word index, its symbol
+        std::vector<const symbolEntry*>                 m_labels;   // in order of definition
+};
+
+void assemble(const std::string& filename, bool map = false){
+    symbol_table.reset();
+    Parser parser(filename);
+    Coder coder(filename);
+    std::ofstream map_file;     // source map: the asm line of every ROM word, in ROM order
+    if (map)    map_file.open(filename.substr(0, filename.size() - 4) + ".hack.map");
     int line_number = 0, var_address = VAR_ADDRESS;
-    while (parser.hasMoreLines()){
-        parser.parse();
-        if (parser.instructionType() == L_INSTRUCTION){
-            --line_number;
-            symbol_table[parser.symbol()] = std::to_string(line_number + 1);
+    {
+        TRACE_SCOPE("assembler first pass");
+        while (parser.hasMoreLines()){
+            parser.parse();
+            if (parser.instructionType() == L_INSTRUCTION)  symbol_table.define(parser.symbol(), line_number);
+            else                                            ++line_number;
         }
-        ++line_number;
     }
 
-    parser.reset(argv[1]);
-    while (parser.hasMoreLines()){
-        parser.parse();
-        std::string instruction;
-        if (parser.instructionType() == C_INSTRUCTION){
-            instruction = "111" + coder.comp(parser.comp()) + coder.dest(parser.dest()) + coder.jump(parser.jump());
-            coder.write(instruction);
-        }
-        else if (parser.instructionType() == A_INSTRUCTION){
-            std::string symbol = parser.symbol();
-            if (isNumber(symbol)){
-                instruction = "0" + std::bitset<ADDRESS_LEN>(std::stoi(symbol)).to_string();
+    parser.reset(filename);
+    {
+        TRACE_SCOPE("assembler second pass");
+        while (parser.hasMoreLines()){
+            parser.parse();
+            std::string instruction;
+            if (parser.instructionType() == C_INSTRUCTION){
+                instruction = "111" + coder.comp(parser.comp()) + coder.dest(parser.dest()) + coder.jump(parser.jump());
+                coder.write(instruction);
+                if (map)    map_file << parser.lineNumber() << "\n";
             }
-            else {
-                if (symbol_table.find(symbol) != symbol_table.end()){
-                    instruction = "0" + std::bitset<ADDRESS_LEN>(std::stoi(symbol_table[symbol])).to_string();
-                }
-                else {  // symbol not present in the symbol table 
-                    symbol_table[symbol] = std::to_string(var_address);
-                    instruction = "0" + std::bitset<ADDRESS_LEN>(var_address).to_string();
-                    ++var_address;
+            else if (parser.instructionType() == A_INSTRUCTION){
+                const std::string& symbol = parser.symbol();
+                uint16_t address = isNumber(symbol) ? parseNumber(symbol) : symbol_table.lookupOrAllocate(symbol, var_address);
+                coder.writeWord(address & ADDRESS_MASK);
+                if (map)    map_file << parser.lineNumber() << "\n";
+            }
+        }
+    }
+}
+
+struct sourceChunk{     // a run of whole source lines for the parallel assembler
+    std::string_view                                text;
+    std::vector<std::string_view>                   lines;      // cleaned in place, empty ones included
+    int                                             first_line = 0;     // 0-based, of the whole file
+    int                                             words = 0;
+    int                                             base = 0;   // ROM address of its first word
+    std::vector<std::pair<std::string_view, int>>   labels;     // name, word offset in the chunk
+    std::vector<std::string_view>                   variables;  // symbols no label defines, in first use order
+    std::string                                     hack;
+    std::string                                     map;
+};
+
+// runs job on every chunk, the chunks handed out to threads one at a time
+template <typename Job>
+void forEachChunk(std::vector<sourceChunk>& chunks, int threads, Job job){
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++){
+        workers.emplace_back([&](){
+            size_t index;
+            while ((index = next.fetch_add(1)) < chunks.size())     job(chunks[index]);
+        });
+    }
+    for (std::thread& worker : workers)     worker.join();
+}
+
+std::string_view cleanLine(char* begin, char* end){     // as Parser::cleanInstruction, in place
+    char* out = begin;
+    for (char* c = begin; c != end && *c != '/'; c++){
+        if (!std::isspace((unsigned char)*c))   *out++ = *c;
+    }
+    return std::string_view(begin, out - begin);
+}
+
+// the encoding of each instruction only needs the symbol table, which is complete once the labels are in
+// and a serial pre-scan has numbered the variables in order of first use; everything else runs on
+// threads chunk by chunk, and the output is the same as assemble()'s bit for bit
+void assembleParallel(const std::string& filename, int threads, bool map = false){
+    std::ifstream infile(filename, std::ios::binary);
+    if (!infile.is_open()){
+        std::exit(1);
+    }
+    std::stringstream contents;
+    contents << infile.rdbuf();
+    std::string source = contents.str();
+
+    std::vector<sourceChunk> chunks;
+    for (size_t start = 0; start < source.size();){
+        size_t end = std::min(start + CHUNK_BYTES, source.size());
+        while (end < source.size() && source[end - 1] != '\n')     ++end;
+        chunks.push_back(sourceChunk());
+        chunks.back().text = std::string_view(source.data() + start, end - start);
+        start = end;
+    }
+
+    {
+        TRACE_SCOPE("assembler parallel scan");
+        forEachChunk(chunks, threads, [](sourceChunk& chunk){
+            char* begin = const_cast<char*>(chunk.text.data());
+            char* end = begin + chunk.text.size();
+            while (begin != end){
+                char* line_end = std::find(begin, end, '\n');
+                std::string_view line = cleanLine(begin, line_end);
+                chunk.lines.push_back(line);
+                if (!line.empty() && line[0] == '(')    chunk.labels.push_back({line.substr(1, line.size() - 2), chunk.words});
+                else if (!line.empty())                 ++chunk.words;
+                begin = line_end == end ? end : line_end + 1;
+            }
+        });
+    }
+
+    symbol_table.reset();
+    int line = 0, address = 0;
+    for (sourceChunk& chunk : chunks){
+        chunk.first_line = line;
+        chunk.base = address;
+        line += chunk.lines.size();
+        address += chunk.words;
+        for (const auto& label : chunk.labels)  symbol_table.define(label.first, chunk.base + label.second);
+    }
+
+    {
+        TRACE_SCOPE("assembler variable pre-scan");
+        forEachChunk(chunks, threads, [](sourceChunk& chunk){
+            std::unordered_set<std::string_view> seen;
+            for (std::string_view line : chunk.lines){
+                if (line.empty() || line[0] != '@')     continue;
+                std::string_view symbol = line.substr(1);
+                if (!isNumber(symbol) && symbol_table.find(symbol) == nullptr && seen.insert(symbol).second){
+                    chunk.variables.push_back(symbol);
                 }
             }
-            coder.write(instruction);
+        });
+        int var_address = VAR_ADDRESS;
+        for (const sourceChunk& chunk : chunks){
+            for (std::string_view symbol : chunk.variables)     symbol_table.lookupOrAllocate(symbol, var_address);
         }
     }
+
+    const Coder coder;
+    {
+        TRACE_SCOPE("assembler parallel encoding");
+        forEachChunk(chunks, threads, [&coder, map](sourceChunk& chunk){
+            chunk.hack.reserve(chunk.words * 17);
+            std::string dest, comp, jump;
+            for (size_t i = 0; i < chunk.lines.size(); i++){
+                std::string_view line = chunk.lines[i];
+                if (line.empty() || line[0] == '(')     continue;
+                if (line[0] == '@'){
+                    std::string_view symbol = line.substr(1);
+                    uint16_t word = (isNumber(symbol) ? parseNumber(symbol) : *symbol_table.find(symbol)) & ADDRESS_MASK;
+                    for (int bit = 15; bit >= 0; bit--)     chunk.hack += (char)('0' + ((word >> bit) & 1));
+                    chunk.hack += '\n';
+                }
+                else {
+                    comp.clear();
+                    jump.clear();
+                    splitCInstruction(std::string(line), dest, comp, jump);
+                    coder.appendC(chunk.hack, dest, comp, jump);
+                }
+                if (map)    chunk.map += std::to_string(chunk.first_line + i + 1) + "\n";
+            }
+        });
+    }
+
+    std::ofstream outfile(filename.substr(0, filename.size() - 4) + ".hack", std::ios::binary);
+    std::ofstream map_file;
+    if (map)    map_file.open(filename.substr(0, filename.size() - 4) + ".hack.map");
+    for (const sourceChunk& chunk : chunks){
+        outfile << chunk.hack;
+        if (map)    map_file << chunk.map;
+    }
+    TRACE_COUNT("hack words written", address);
+}
+
+// separate assembly: File.asm -> File.hobj, to be placed and resolved by Tools/linker
+void assembleObject(const std::string& filename){
+    std::ifstream infile(filename, std::ios::binary);
+    if (!infile){
+        std::cout << "Could not open " << filename << "\n";
+        std::exit(1);
+    }
+    std::string source((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+    Encoder encoder;
+    char* begin = source.data();
+    char* end = begin + source.size();
+    while (begin != end){
+        char* line_end = std::find(begin, end, '\n');
+        std::string_view line = cleanLine(begin, line_end);
+        if (!line.empty())  encoder.addLine(std::string(line));
+        begin = line_end == end ? end : line_end + 1;
+    }
+    std::ofstream outfile(filename.substr(0, filename.size() - 4) + ".hobj");
+    encoder.writeObject(outfile);
+}
+
+int main(int argc, char* argv[]){
+    bool map = false, object = false;
+    int threads = 0;    // serial
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--map")                            map = true;
+        else if (flag == "--parallel")                  threads = std::max(1u, std::thread::hardware_concurrency());
+        else if (flag == "--threads" && i + 1 < argc)   threads = std::max(1, std::stoi(argv[++i]));
+        else if (flag == "--object")                    object = true;
+        else                                            argc = 0;
+    }
+    if (argc < 2){   // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+    if (object)             assembleObject(argv[1]);
+    else if (threads > 0)   assembleParallel(argv[1], threads, map);
+    else                    assemble(argv[1], map);
     return 0;
 }
\ No newline at end of file
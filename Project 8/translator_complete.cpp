@@ -5,12 +5,21 @@
 #include <cctype>
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
 #include <filesystem>
 #include <vector>
+#include <cstdint>
+#include "../Tools/trace.h"
 
 namespace fs = std::filesystem;
 
+#define INLINE_MAX_BODY (12)    // callee bodies longer than this many VM commands are never inlined
+#define TEMP_SLOTS (8)          // temp 0-7 is caller-clobbered across a call, so inlined bodies use it as scratch
+#define REGISTER_LOCALS (4)     // calling convention shared with the compiler: local 0-3 of eligible functions live in registers
+#define REGISTER_ARGS (4)       // argument 0-3 of eligible functions are copied into registers on entry
+#define VARIABLE_WORDS (240)    // RAM 16-255, below the stack, holds the statics and the registers
+
 enum InstructionType{
     C_ARITHMETIC,
     C_PUSH,
@@ -22,6 +31,7 @@ enum InstructionType{
     C_FUNCTION,
     C_RETURN,
     C_CALL,
+    C_TAIL_CALL,    // a call followed by return, made by --tail-calls; never parsed
     INVALID
 };
 
@@ -49,8 +59,30 @@ void initCommandTable(){
     command_table[""]           = INVALID;
 }
 
+struct vmCommand{
+    InstructionType         type;
+    std::string             arg1;
+    std::string             arg2;
+    int                     line = 0;   // in the .vm file, for the source map
+    int                     frame_args = -1;    // C_TAIL_CALL: arguments every call of the current function passes, -1 if they differ
+};
+
+struct vmFile{
+    std::string                 name;       // file name without the directory, used for label and static scoping
+    std::vector<vmCommand>      commands;
+};
+
+static uint64_t contentHash(const std::string& content){    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : content){
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 std::string getFilenameFromPath(std::string filename){
-    int slash_index = 0;
+    int slash_index = -1;
     for (int i = 0; i < filename.size(); i++){
         if (filename[i] == '/'){
             slash_index = i;
@@ -81,6 +113,7 @@ class Parser{
             if (hasMoreLines()){
                 do {
                     std::getline(m_infile, m_current_instruction);
+                    ++m_line_number;
                     cleanInstruction();
                 }
                 while (!isValidInstruction() && hasMoreLines());
@@ -106,9 +139,11 @@ class Parser{
         }
 
         void parse(){
+            TRACE_SCOPE("translator Parser::parse");
             advance();
             initStrings();
             if (isValidInstruction()){
+                TRACE_COUNT("vm commands parsed", 1);
                 std::stringstream instruction_stream(m_current_instruction);
                 std::string symbol;
                 instruction_stream >> symbol;
@@ -156,17 +191,87 @@ class Parser{
             return m_arg2;
         }
 
+        int lineNumber(){
+            return m_line_number;
+        }
+
     private:
         std::ifstream           m_infile;
         std::string             m_current_instruction;
         InstructionType         m_current_instruction_type;
         std::string             m_arg1;
         std::string             m_arg2;
+        int                     m_line_number = 0;
+};
+
+class romCounter : public std::streambuf{    // output sink that only counts emitted instructions (labels excluded)
+    public:
+        romCounter() : m_count(0), m_line_start(true), m_is_label(false){}
+
+        int count() const {
+            return m_count;
+        }
+
+    protected:
+        int overflow(int ch) override {
+            if (m_line_start){
+                m_is_label = (ch == '(');
+                m_line_start = false;
+            }
+            if (ch == '\n'){
+                if (!m_is_label)    ++m_count;
+                m_line_start = true;
+            }
+            return ch;
+        }
+
+    private:
+        int                     m_count;
+        bool                    m_line_start;
+        bool                    m_is_label;
+};
+
+class lineCounter : public std::streambuf{  // pass-through sink that keeps count of the asm lines written, for the source map
+    public:
+        lineCounter(std::streambuf* target) : m_target(target), m_lines(0){}
+
+        void setTarget(std::streambuf* target){
+            m_target = target;
+        }
+
+        long lines() const {
+            return m_lines;
+        }
+
+    protected:
+        int overflow(int ch) override {
+            if (ch == '\n')     ++m_lines;
+            return m_target->sputc(ch);
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            m_lines += std::count(s, s + n, '\n');
+            return m_target->sputn(s, n);
+        }
+
+        int sync() override {
+            return m_target->pubsync();
+        }
+
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+            return m_target->pubseekoff(off, dir, which);
+        }
+
+    private:
+        std::streambuf*         m_target;
+        long                    m_lines;
 };
 
 class CodeWriter{
     public:
-        CodeWriter(const std::string& filename){
+        CodeWriter(std::streambuf* sink) : m_lines(sink), m_outfile(&m_lines){}
+
+        CodeWriter(const std::string& filename) : m_lines(nullptr), m_outfile(nullptr){
             std::string fname;
             if (filename.substr(filename.size() - 3, 3) == ".vm"){
                 fname = filename.substr(0, filename.size() - 2) + "asm";
@@ -178,23 +283,29 @@ class CodeWriter{
                 fname = filename + fname + ".asm";
             }
             std::cout << fname << std::endl;
-            m_outfile.open(fname);
-            if (!m_outfile.is_open()){
+            m_file.open(fname);
+            if (!m_file.is_open()){
                 std::exit(1);
             }
+            m_filename = fname;
+            m_lines.setTarget(m_file.rdbuf());
+            m_outfile.rdbuf(&m_lines);
         }
 
         ~CodeWriter(){
-            m_outfile.close();
+            m_outfile.flush();
+            if (m_file.is_open())       TRACE_COUNT("asm bytes written", m_outfile.tellp());
         }
 
         void setFileName(const std::string& filename){
             m_file_name = filename.substr(0, filename.size() - 3);
+            m_function_name = "";
             m_return_index = 0;
             m_continue_index = 0;
         }
 
         void writeArithmetic(const std::string& command){
+            TRACE_SCOPE("CodeWriter::writeArithmetic");
             if (command == "not"){
                 writePopOnly();
                 m_outfile << "M=!M\n";
@@ -208,7 +319,7 @@ class CodeWriter{
                 m_outfile << "D=M\n";
                 writePopOnly();
                 if (command == "add")           m_outfile << "M=D+M\n";
-                else if (command == "sub")      m_outfile << "M=D-M\n";
+                else if (command == "sub")      m_outfile << "M=M-D\n";
                 else if (command == "and")      m_outfile << "M=D&M\n";
                 else if (command == "or")       m_outfile << "M=D|M\n";
                 else {
@@ -227,49 +338,107 @@ class CodeWriter{
             }
         }
 
+        void setRegisterFunctions(const std::unordered_map<std::string, int>& register_args){
+            m_register_args = register_args;
+        }
+
         void writePushPop(InstructionType cmdtype, const std::string& segment, const std::string& index){
-            if (cmdtype == C_POP){
-                if (segment == "")          writePop();
+            TRACE_SCOPE("CodeWriter::writePushPop");
+            if (isRegister(segment, index)){
+                if (cmdtype == C_POP){
+                    writePop();
+                    m_outfile << "D=M\n"
+                              << "@" << registerSymbol(segment, index) << "\n"
+                              << "M=D\n";
+                }
                 else {
-                    if (index != "0"){
-                        m_outfile << "@" << index << "\n"
-                                  << "D=A\n";
-                    }
-                    m_outfile << "@" << segment << "\n"
-                                << "D=M+D\n"
-                                << "@R13\n"
-                                << "M=D\n";
+                    m_outfile << "@" << registerSymbol(segment, index) << "\n"
+                              << "D=M\n";
+                    writePush();
+                }
+            }
+            else if (segment == "temp" || segment == "pointer" || segment == "static"){     // fixed addresses
+                if (cmdtype == C_POP){
+                    writePop();
+                    m_outfile << "D=M\n"
+                              << "@" << fixedAddress(segment, index) << "\n"
+                              << "M=D\n";
+                }
+                else {
+                    m_outfile << "@" << fixedAddress(segment, index) << "\n"
+                              << "D=M\n";
+                    writePush();
+                }
+            }
+            else if (cmdtype == C_POP){
+                if (index == "0"){
+                    writePop();
+                    m_outfile << "D=M\n"
+                              << "@" << segmentBase(segment) << "\n"
+                              << "A=M\n"
+                              << "M=D\n";
+                }
+                else {
+                    m_outfile << "@" << index << "\n"
+                              << "D=A\n"
+                              << "@" << segmentBase(segment) << "\n"
+                              << "D=D+M\n"
+                              << "@R13\n"
+                              << "M=D\n";
                     writePop();
                     m_outfile << "D=M\n"
                               << "@R13\n"
                               << "A=M\n"
                               << "M=D\n";
-                }      
+                }
             }
             else {
-                if (index != "0"){
+                if (segment == "constant"){
                     m_outfile << "@" << index << "\n"
                               << "D=A\n";
                 }
-                if (segment != "" && segment != "constant"){
-                    m_outfile << "@" << segment << "\n"
-                              << "A=M+D\n"
+                else if (index == "0"){
+                    m_outfile << "@" << segmentBase(segment) << "\n"
+                              << "A=M\n"
+                              << "D=M\n";
+                }
+                else {
+                    m_outfile << "@" << index << "\n"
+                              << "D=A\n"
+                              << "@" << segmentBase(segment) << "\n"
+                              << "A=D+M\n"
                               << "D=M\n";
                 }
                 writePush();
             }
         }
 
+        std::string segmentBase(const std::string& segment){
+            if (segment == "local")         return "LCL";
+            if (segment == "argument")      return "ARG";
+            if (segment == "this")          return "THIS";
+            return "THAT";
+        }
+
+        std::string fixedAddress(const std::string& segment, const std::string& index){
+            if (segment == "temp")          return std::to_string(5 + std::stoi(index));
+            if (segment == "pointer")       return std::to_string(3 + std::stoi(index));
+            return m_file_name + "." + index;   // statics are allocated by the assembler, one set per file
+        }
+
         void writeLabel(const std::string& label){
+            TRACE_SCOPE("CodeWriter::writeLabel");
             m_outfile << "(" << m_file_name << "$" << label << ")\n";
         }
 
         void writeGoto(const std::string& label){
+            TRACE_SCOPE("CodeWriter::writeGoto");
             m_outfile << "@" << m_file_name << "$" << label << "\n";
             m_outfile << "0;JMP\n";
         }
 
         void writeIf(const std::string& label){
+            TRACE_SCOPE("CodeWriter::writeIf");
             writePop();
             m_outfile << "D=M\n";
             m_outfile << "@" << m_file_name << "$" << label << "\n";
@@ -277,42 +446,130 @@ class CodeWriter{
         }
 
         void writeFunction(const std::string& fun_name, int n_vars){
-            writeLabel(fun_name);
-            for (int i = 0; i < n_vars; i++)    m_outfile << "push 0\n";
+            TRACE_SCOPE("CodeWriter::writeFunction");
+            m_function_name = fun_name;
+            m_register_vars = 0;
+            m_outfile << "(" << fun_name << ")\n";
+            for (int i = 0; i < n_vars; i++){
+                m_outfile << "@SP\n"
+                          << "M=M+1\n"
+                          << "A=M-1\n"
+                          << "M=0\n";
+            }
+            auto register_args = m_register_args.find(fun_name);
+            if (register_args != m_register_args.end()){
+                m_register_vars = std::min(n_vars, REGISTER_LOCALS);
+                for (int i = 0; i < m_register_vars; i++){
+                    m_outfile << "@" << registerSymbol("local", std::to_string(i)) << "\n"
+                              << "M=0\n";
+                }
+                for (int i = 0; i < register_args->second; i++){   // arguments are passed by value, so a copy-in is enough
+                    m_outfile << "@ARG\n"
+                              << "A=M\n";
+                    for (int j = 0; j < i; j++)     m_outfile << "A=A+1\n";
+                    m_outfile << "D=M\n"
+                              << "@" << registerSymbol("argument", std::to_string(i)) << "\n"
+                              << "M=D\n";
+                }
+            }
         }
 
         void writeCall(const std::string& fun_name, int n_vars){
-            std::string ret_addr = "@" + m_file_name + "." + fun_name + "$ret." + std::to_string(m_return_index);
-            m_outfile << ret_addr << "\n"
+            TRACE_SCOPE("CodeWriter::writeCall");
+            std::string ret_label = m_file_name + "$ret." + std::to_string(m_return_index);
+            m_outfile << "@" << ret_label << "\n"
                       << "D=A\n";
             writePush();
             writePushSegment("LCL");
             writePushSegment("ARG");
             writePushSegment("THIS");
-            writePushSegment("THAT");   
+            writePushSegment("THAT");
             m_outfile << "@SP\n"
                       << "D=M\n"
                       << "@LCL\n"
                       << "M=D\n"
+                      << "@" << 5 + n_vars << "\n"
+                      << "D=D-A\n"
                       << "@ARG\n"
-                      << "M=D-1\n";
-            for (int i = 0; i < 5 + n_vars - 1; i++)    m_outfile << "M=M-1\n";
-            m_outfile << "@" << m_file_name << "." << fun_name << "\n"
-                      << "0;JMP\n"; 
-            m_outfile << "(" + m_file_name + "." + fun_name + "$ret." + std::to_string(m_return_index) + ")\n";
+                      << "M=D\n"
+                      << "@" << fun_name << "\n"
+                      << "0;JMP\n"
+                      << "(" << ret_label << ")\n";
             ++m_return_index;
         }
 
+        // a call in tail position reuses the current frame, so the callee returns straight to our caller. When
+        // every call of the current function passes as many arguments as this one, our caller's saved frame
+        // already sits where the callee expects it and only the arguments move down over ours; otherwise the
+        // saved frame waits in temp, which no caller keeps across a call, and goes back right after them.
+        // The only jump is the last one, the call's
+        void writeTailCall(const std::string& fun_name, int n_vars, int frame_args){
+            TRACE_SCOPE("CodeWriter::writeTailCall");
+            bool same_frame = frame_args == n_vars;
+            for (int i = 0; i < 5 && !same_frame; i++){    // return address, LCL, ARG, THIS, THAT
+                m_outfile << "@" << 5 - i << "\n"
+                          << "D=A\n"
+                          << "@LCL\n"
+                          << "A=M-D\n"
+                          << "D=M\n"
+                          << "@" << fixedAddress("temp", std::to_string(i)) << "\n"
+                          << "M=D\n";
+            }
+            if (n_vars > 0 || !same_frame){
+                m_outfile << "@SP\n"
+                          << "D=M\n"
+                          << "@" << n_vars << "\n"
+                          << "D=D-A\n"
+                          << "@R13\n"
+                          << "M=D\n"
+                          << "@ARG\n"
+                          << "D=M\n"
+                          << "@R14\n"
+                          << "M=D\n";
+            }
+            for (int i = 0; i < n_vars; i++){   // upwards, as the arguments only ever move down
+                m_outfile << "@R13\n"
+                          << "M=M+1\n"
+                          << "A=M-1\n"
+                          << "D=M\n"
+                          << "@R14\n"
+                          << "M=M+1\n"
+                          << "A=M-1\n"
+                          << "M=D\n";
+            }
+            for (int i = 0; i < 5 && !same_frame; i++){
+                m_outfile << "@" << fixedAddress("temp", std::to_string(i)) << "\n"
+                          << "D=M\n"
+                          << "@R14\n"
+                          << "M=M+1\n"
+                          << "A=M-1\n"
+                          << "M=D\n";
+            }
+            if (!same_frame){
+                m_outfile << "@R14\n"
+                          << "D=M\n"
+                          << "@LCL\n"
+                          << "M=D\n";
+            }
+            m_outfile << "@LCL\n"
+                      << "D=M\n"
+                      << "@SP\n"
+                      << "M=D\n"
+                      << "@" << fun_name << "\n"
+                      << "0;JMP\n";
+        }
+
         void writeReturn(){
-            --m_return_index;
+            TRACE_SCOPE("CodeWriter::writeReturn");
             // temp frame
             m_outfile << "@LCL\n"
                       << "D=M\n"
                       << "@R13\n"
-                      << "AM=D\n";
-            for (int i = 0; i < 5; i++)     m_outfile << "A=A-1\n";
+                      << "M=D\n";
             // temp ret_addrs
-            m_outfile << "D=M\n"
+            m_outfile << "@5\n"
+                      << "A=D-A\n"
+                      << "D=M\n"
                       << "@R14\n"
                       << "M=D\n";
             // reposition arg and sp
@@ -321,14 +578,16 @@ class CodeWriter{
                       << "@ARG\n"
                       << "A=M\n"
                       << "M=D\n"
-                      << "D=D+1\n"
+                      << "@ARG\n"
+                      << "D=M+1\n"
                       << "@SP\n"
-                      << "M=D\n"; 
+                      << "M=D\n";
             writeRestoreSegment("THAT");
             writeRestoreSegment("THIS");
             writeRestoreSegment("ARG");
             writeRestoreSegment("LCL");
             m_outfile << "@R14\n"
+                      << "A=M\n"
                       << "0;JMP\n";
         }
 
@@ -340,7 +599,7 @@ class CodeWriter{
 
         void writeRestoreSegment(const std::string& segment){
             m_outfile << "@R13\n"
-                      << "AM=A-1\n"
+                      << "AM=M-1\n"
                       << "D=M\n"
                       << "@" << segment << "\n"
                       << "M=D\n";
@@ -363,6 +622,47 @@ class CodeWriter{
                       << "A=M-1\n";
         }
 
+        bool isRegister(const std::string& segment, const std::string& index){
+            auto register_args = m_register_args.find(m_function_name);
+            if (register_args == m_register_args.end())     return false;
+            if (segment == "local")                         return std::stoi(index) < m_register_vars;
+            if (segment == "argument")                      return std::stoi(index) < register_args->second;
+            return false;
+        }
+
+        std::string registerSymbol(const std::string& segment, const std::string& index){
+            // one static-area word per function and slot, allocated by the assembler like any other variable
+            return m_function_name + (segment == "local" ? "$L" : "$A") + index;
+        }
+
+        void writeFragment(const std::string& fragment){
+            m_outfile << fragment;
+        }
+
+        void writeBootstrap(){      // only for programs that define Sys.init
+            m_file_name = "";
+            m_return_index = 0;
+            m_outfile << "@256\n"
+                      << "D=A\n"
+                      << "@SP\n"
+                      << "M=D\n";
+            writeCall("Sys.init", 0);
+            m_outfile << "@END\n"     // Sys.init is not expected to return, but if it does the program halts
+                      << "0;JMP\n";
+        }
+
+        long lines() const {
+            return m_lines.lines();
+        }
+
+        const std::string& filename() const {
+            return m_filename;
+        }
+
+        const std::string& functionName() const {
+            return m_function_name;
+        }
+
         void writeClosing(){
             m_outfile << "(END)\n"
                       << "@END\n"
@@ -370,20 +670,432 @@ class CodeWriter{
         }
 
     private:
-        std::ofstream           m_outfile;
+        std::ofstream           m_file;
+        std::string             m_filename;
+        lineCounter             m_lines;
+        std::ostream            m_outfile;
         std::string             m_file_name;
-        int                     m_return_index;
-        int                     m_continue_index;
+        int                     m_return_index = 0;
+        int                     m_continue_index = 0;
+        std::string             m_function_name;
+        int                     m_register_vars = 0;
+        std::unordered_map<std::string, int>    m_register_args;    // register functions -> number of arguments copied in
+};
+
+class Inliner{  // whole-program inlining of small straight-line leaf functions at the VM level
+    public:
+        Inliner(std::vector<vmFile>& program) : m_program(program), m_inlined_calls(0){}
+
+        void run(){
+            collectCandidates();
+            for (vmFile& file : m_program){
+                std::vector<vmCommand> commands;
+                for (const vmCommand& command : file.commands){
+                    if (command.type == C_CALL && canInline(command, file.name))    expand(command, commands);
+                    else                                                            commands.push_back(command);
+                }
+                file.commands.swap(commands);
+            }
+        }
+
+        int inlinedCalls() const {
+            return m_inlined_calls;
+        }
+
+        const std::unordered_map<std::string, int>& inlinedPerFunction() const {
+            return m_inlined_per_function;
+        }
+
+    private:
+        struct candidate{
+            std::string                 file;
+            int                         n_vars;
+            int                         max_arg;        // highest argument index referenced, -1 if none
+            bool                        uses_static;    // statics are file scoped, so only same file callers qualify
+            bool                        writes_this;
+            bool                        writes_that;
+            std::vector<vmCommand>      body;           // without the trailing return
+        };
+
+        void collectCandidates(){
+            for (const vmFile& file : m_program){
+                for (size_t i = 0; i < file.commands.size(); i++){
+                    if (file.commands[i].type != C_FUNCTION)    continue;
+                    size_t end = i + 1;
+                    while (end < file.commands.size() && file.commands[end].type != C_FUNCTION)     ++end;
+                    candidate callee;
+                    callee.file = file.name;
+                    callee.n_vars = std::stoi(file.commands[i].arg2);
+                    if (isInlinable(file.commands, i + 1, end, callee)){
+                        m_candidates[file.commands[i].arg1] = callee;
+                    }
+                    i = end - 1;
+                }
+            }
+        }
+
+        bool isInlinable(const std::vector<vmCommand>& commands, int begin, int end, candidate& callee){
+            if (end - begin > INLINE_MAX_BODY || end == begin || commands[end - 1].type != C_RETURN)    return false;
+            callee.max_arg = -1;
+            callee.uses_static = false;
+            callee.writes_this = false;
+            callee.writes_that = false;
+            int depth = 0;      // callee working stack depth, must end with exactly the return value on it
+            for (int i = begin; i < end - 1; i++){
+                const vmCommand& command = commands[i];
+                if (command.type == C_PUSH || command.type == C_POP){
+                    if (command.arg1 == "temp")             return false;
+                    if (command.arg1 == "static")           callee.uses_static = true;
+                    if (command.arg1 == "argument")         callee.max_arg = std::max(callee.max_arg, std::stoi(command.arg2));
+                    if (command.type == C_PUSH)             ++depth;
+                    else {
+                        if (depth < 1)                      return false;
+                        --depth;
+                        if (command.arg1 == "pointer" && command.arg2 == "0")       callee.writes_this = true;
+                        if (command.arg1 == "pointer" && command.arg2 == "1")       callee.writes_that = true;
+                    }
+                }
+                else if (command.type == C_ARITHMETIC){
+                    bool unary = (command.arg1 == "neg" || command.arg1 == "not");
+                    if (depth < (unary ? 1 : 2))            return false;
+                    if (!unary)                             --depth;
+                }
+                else    return false;   // calls, branches, labels and early returns keep the function out of line
+                callee.body.push_back(command);
+            }
+            return depth == 1;
+        }
+
+        bool canInline(const vmCommand& call, const std::string& caller_file){
+            auto callee = m_candidates.find(call.arg1);
+            if (callee == m_candidates.end())                                           return false;
+            if (callee->second.uses_static && callee->second.file != caller_file)       return false;
+            int n_args = std::stoi(call.arg2);
+            if (callee->second.max_arg >= n_args)                                       return false;
+            int slots = n_args + callee->second.n_vars + callee->second.writes_this + callee->second.writes_that;
+            return slots <= TEMP_SLOTS;
+        }
+
+        void expand(const vmCommand& call, std::vector<vmCommand>& out){
+            const candidate& callee = m_candidates[call.arg1];
+            int n_args = std::stoi(call.arg2);
+            int slot = n_args;
+            // a lone argument that the body pushes first and never again can stay where it is on the stack
+            bool keep_top = n_args == 1 && isOnlyFirstUse(callee.body, "0");
+            for (int i = n_args - 1; i >= 0 && !keep_top; i--)     out.push_back({C_POP, "temp", std::to_string(i)});
+            int local_base = slot;
+            for (int i = 0; i < callee.n_vars; i++){
+                out.push_back({C_PUSH, "constant", "0"});
+                out.push_back({C_POP, "temp", std::to_string(slot++)});
+            }
+            int this_slot = callee.writes_this ? slot++ : -1;
+            int that_slot = callee.writes_that ? slot++ : -1;
+            if (this_slot != -1){
+                out.push_back({C_PUSH, "pointer", "0"});
+                out.push_back({C_POP, "temp", std::to_string(this_slot)});
+            }
+            if (that_slot != -1){
+                out.push_back({C_PUSH, "pointer", "1"});
+                out.push_back({C_POP, "temp", std::to_string(that_slot)});
+            }
+            for (size_t i = keep_top ? 1 : 0; i < callee.body.size(); i++){
+                vmCommand command = callee.body[i];
+                if (command.arg1 == "argument"){
+                    command.arg1 = "temp";
+                }
+                else if (command.arg1 == "local"){
+                    command.arg1 = "temp";
+                    command.arg2 = std::to_string(local_base + std::stoi(command.arg2));
+                }
+                out.push_back(command);
+            }
+            // the return value stays on top, restoring the caller's pointers leaves it there
+            if (this_slot != -1){
+                out.push_back({C_PUSH, "temp", std::to_string(this_slot)});
+                out.push_back({C_POP, "pointer", "0"});
+            }
+            if (that_slot != -1){
+                out.push_back({C_PUSH, "temp", std::to_string(that_slot)});
+                out.push_back({C_POP, "pointer", "1"});
+            }
+            ++m_inlined_calls;
+            ++m_inlined_per_function[call.arg1];
+        }
+
+        bool isOnlyFirstUse(const std::vector<vmCommand>& body, const std::string& arg_index){
+            if (body[0].type != C_PUSH || body[0].arg1 != "argument" || body[0].arg2 != arg_index)    return false;
+            for (size_t i = 1; i < body.size(); i++){
+                if (body[i].arg1 == "argument" && body[i].arg2 == arg_index)    return false;
+            }
+            return true;
+        }
+
+        std::vector<vmFile>&                            m_program;
+        std::unordered_map<std::string, candidate>      m_candidates;
+        std::unordered_map<std::string, int>            m_inlined_per_function;
+        int                                             m_inlined_calls;
+};
+
+class CallGraph{    // decides which functions may keep locals and arguments in fixed registers
+    public:
+        CallGraph(const std::vector<vmFile>& program){
+            std::string function;
+            for (const vmFile& file : program){
+                for (const vmCommand& command : file.commands){
+                    if ((command.type == C_PUSH || command.type == C_POP) && command.arg1 == "static"){
+                        m_statics.insert(file.name + "." + command.arg2);
+                    }
+                    if (command.type == C_FUNCTION){
+                        function = command.arg1;
+                        m_callees[function];
+                        m_max_arg[function] = -1;
+                        m_vars[function] = std::stoi(command.arg2);
+                    }
+                    else if (function == ""){
+                        continue;
+                    }
+                    else if (command.type == C_CALL || command.type == C_TAIL_CALL){
+                        m_callees[function].push_back(command.arg1);
+                        ++m_call_sites[command.arg1];
+                    }
+                    else if ((command.type == C_PUSH || command.type == C_POP) && command.arg1 == "argument"){
+                        m_max_arg[function] = std::max(m_max_arg[function], std::stoi(command.arg2));
+                    }
+                }
+            }
+        }
+
+        // a register is a single word per function, so a function qualifies only if it can never be
+        // re-entered while active: it must not reach itself, and must not reach code outside the program.
+        // Registers share RAM 16-255 with the statics, so the most called functions get theirs first and
+        // the ones that no longer fit keep their locals and arguments on the stack
+        std::unordered_map<std::string, int> registerFunctions(){
+            int free_words = VARIABLE_WORDS - (int)m_statics.size();
+            if (free_words < 0){
+                std::cout << m_statics.size() << " statics do not fit below the stack" << "\n";
+                std::exit(1);
+            }
+            std::vector<std::string> functions;
+            for (const auto& function : m_callees){
+                if (!isRecursive(function.first))   functions.push_back(function.first);
+            }
+            std::sort(functions.begin(), functions.end(), [&](const std::string& a, const std::string& b){
+                return m_call_sites[a] != m_call_sites[b] ? m_call_sites[a] > m_call_sites[b] : a < b;
+            });
+            std::unordered_map<std::string, int> register_args;
+            m_left_out = 0;
+            for (const std::string& function : functions){
+                int args = std::min(m_max_arg[function] + 1, REGISTER_ARGS);
+                int words = args + std::min(m_vars[function], REGISTER_LOCALS);
+                if (words > free_words){
+                    ++m_left_out;
+                    continue;
+                }
+                free_words -= words;
+                register_args[function] = args;
+            }
+            return register_args;
+        }
+
+        int leftOut() const {       // functions that qualified but found no room, as of registerFunctions()
+            return m_left_out;
+        }
+
+        bool isRecursive(const std::string& function){
+            std::unordered_set<std::string> visited;
+            std::vector<std::string> pending(m_callees[function]);
+            while (!pending.empty()){
+                std::string callee = pending.back();
+                pending.pop_back();
+                if (callee == function || m_callees.find(callee) == m_callees.end())    return true;
+                if (!visited.insert(callee).second)                                     continue;
+                for (const std::string& next : m_callees[callee])       pending.push_back(next);
+            }
+            return false;
+        }
+
+    private:
+        std::unordered_map<std::string, std::vector<std::string>>   m_callees;
+        std::unordered_map<std::string, int>                        m_max_arg;
+        std::unordered_map<std::string, int>                        m_vars;
+        std::unordered_map<std::string, int>                        m_call_sites;
+        std::unordered_set<std::string>                             m_statics;
+        int                                                         m_left_out = 0;
+};
+
+void writeCommand(CodeWriter& writer, const vmCommand& command){
+    if (command.type == C_PUSH || command.type == C_POP){
+        writer.writePushPop(command.type, command.arg1, command.arg2);
+    }
+    else if (command.type == C_ARITHMETIC){
+        writer.writeArithmetic(command.arg1);
+    }
+    else if (command.type == C_LABEL){
+        writer.writeLabel(command.arg1);
+    }
+    else if (command.type == C_GOTO){
+        writer.writeGoto(command.arg1);
+    }
+    else if (command.type == C_IF_GOTO){
+        writer.writeIf(command.arg1);
+    }
+    else if (command.type == C_FUNCTION){
+        writer.writeFunction(command.arg1, std::stoi(command.arg2));
+    }
+    else if (command.type == C_CALL){
+        writer.writeCall(command.arg1, std::stoi(command.arg2));
+    }
+    else if (command.type == C_TAIL_CALL){
+        writer.writeTailCall(command.arg1, std::stoi(command.arg2), command.frame_args);
+    }
+    else if (command.type == C_RETURN){
+        writer.writeReturn();
+    }
+}
+
+// the source map has one line per VM command that produced code: "first_asm_line last_asm_line vm_file vm_line function kind",
+// where kind tells the jumps of call, tail call and return apart from branches inside a function; calls also name their callee
+void writeFile(CodeWriter& writer, const vmFile& file, std::ostream* map = nullptr){
+    writer.setFileName(file.name);
+    for (const vmCommand& command : file.commands){
+        long first = writer.lines();
+        writeCommand(writer, command);
+        if (map != nullptr && writer.lines() > first){
+            const char* kind = command.type == C_CALL ? "call" : (command.type == C_TAIL_CALL ? "tail" : (command.type == C_RETURN ? "return" : "code"));
+            *map << first + 1 << " " << writer.lines() << " " << file.name << " " << command.line << " " << writer.functionName() << " " << kind;
+            if (command.type == C_CALL || command.type == C_TAIL_CALL)     *map << " " << command.arg1;
+            *map << "\n";
+        }
+    }
+}
+
+bool definesFunction(const std::vector<vmFile>& program, const std::string& function){
+    for (const vmFile& file : program){
+        for (const vmCommand& command : file.commands){
+            if (command.type == C_FUNCTION && command.arg1 == function)     return true;
+        }
+    }
+    return false;
+}
+
+// "call f n" straight before "return" becomes one C_TAIL_CALL, which replaces the current frame instead of
+// stacking a new one; the return would only have passed f's result on
+int markTailCalls(std::vector<vmFile>& program){
+    std::unordered_map<std::string, int> frame_args;    // function -> arguments every call passes, -1 if they differ
+    if (definesFunction(program, "Sys.init"))   frame_args["Sys.init"] = 0;    // the bootstrap's call
+    for (const vmFile& file : program){
+        for (const vmCommand& command : file.commands){
+            if (command.type != C_CALL)     continue;
+            auto entry = frame_args.insert({command.arg1, std::stoi(command.arg2)});
+            if (entry.first->second != std::stoi(command.arg2))     entry.first->second = -1;
+        }
+    }
+    int tail_calls = 0;
+    for (vmFile& file : program){
+        std::vector<vmCommand> commands;
+        std::string function;
+        for (size_t i = 0; i < file.commands.size(); i++){
+            commands.push_back(file.commands[i]);
+            if (file.commands[i].type == C_FUNCTION)    function = file.commands[i].arg1;
+            if (file.commands[i].type == C_CALL && i + 1 < file.commands.size() && file.commands[i + 1].type == C_RETURN){
+                auto known = frame_args.find(function);
+                commands.back().type = C_TAIL_CALL;
+                commands.back().frame_args = known == frame_args.end() ? -1 : known->second;
+                ++i;
+                ++tail_calls;
+            }
+        }
+        file.commands.swap(commands);
+    }
+    return tail_calls;
+}
+
+void writeProgram(CodeWriter& writer, const std::vector<vmFile>& program, std::ostream* map = nullptr){
+    if (definesFunction(program, "Sys.init"))   writer.writeBootstrap();
+    for (const vmFile& file : program)      writeFile(writer, file, map);
+    writer.writeClosing();
+}
+
+class fragmentCache{    // on-disk asm fragment of every .vm file, keyed by what its translation depends on
+    public:
+        fragmentCache(const std::string& filename) : m_filename(filename){
+            std::ifstream infile(filename, std::ios::binary);
+            std::string vm_file;
+            uint64_t key;
+            size_t size;
+            while (infile >> vm_file >> key >> size){
+                infile.get();   // "\n"
+                std::string fragment(size, '\0');
+                infile.read(&fragment[0], size);
+                m_entries[vm_file] = {key, fragment};
+            }
+        }
+
+        const std::string* find(const std::string& vm_file, uint64_t key){
+            auto entry = m_entries.find(vm_file);
+            if (entry == m_entries.end() || entry->second.first != key)     return nullptr;
+            m_current[vm_file] = entry->second;
+            return &entry->second.second;
+        }
+
+        void store(const std::string& vm_file, uint64_t key, const std::string& fragment){
+            m_current[vm_file] = {key, fragment};
+        }
+
+        void save(){    // only files seen in this run are kept
+            std::ofstream outfile(m_filename, std::ios::binary);
+            for (const auto& entry : m_current){
+                outfile << entry.first << " " << entry.second.first << " " << entry.second.second.size() << "\n"
+                        << entry.second.second;
+            }
+        }
+
+    private:
+        std::string                                                             m_filename;
+        std::unordered_map<std::string, std::pair<uint64_t, std::string>>       m_entries;
+        std::unordered_map<std::string, std::pair<uint64_t, std::string>>       m_current;
 };
 
+// the commands after inlining plus the register decisions for the file's own functions are everything
+// its fragment depends on; keying on them keeps whole-program passes correct across incremental runs
+uint64_t fragmentKey(const vmFile& file, const std::unordered_map<std::string, int>& register_args){
+    std::string key = file.name + "\n";
+    for (const vmCommand& command : file.commands){
+        key += std::to_string(command.type) + " " + command.arg1 + " " + command.arg2 + (command.type == C_TAIL_CALL ? " " + std::to_string(command.frame_args) : "") + "\n";
+        auto register_function = register_args.find(command.arg1);
+        if (command.type == C_FUNCTION && register_function != register_args.end()){
+            key += "registers " + std::to_string(register_function->second) + "\n";
+        }
+    }
+    return contentHash(key);
+}
+
+int romSize(const std::vector<vmFile>& program, const std::unordered_map<std::string, int>& register_args){
+    romCounter counter;
+    CodeWriter writer(&counter);
+    writer.setRegisterFunctions(register_args);
+    writeProgram(writer, program);
+    return counter.count();
+}
+
 int main(int argc, char* argv[]){
-    if (argc != 2){ // impose correct usage
+    bool inline_mode = false, register_mode = false, incremental = false, map = false, split = false, tail_calls = false;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--inline")             inline_mode = true;
+        else if (flag == "--map")           map = true;
+        else if (flag == "--registers")     register_mode = true;
+        else if (flag == "--incremental")   incremental = true;
+        else if (flag == "--split")         split = true;
+        else if (flag == "--tail-calls")    tail_calls = true;
+        else                                argc = 0;
+    }
+    if (argc < 2){ // impose correct usage
         std::cout << "Incorrect usage" << "\n";
         return 1;
     }
 
     initCommandTable();
-    CodeWriter writer(argv[1]);
     std::vector <std::string> filenames;
     std::string path(argv[1]);
 
@@ -399,38 +1111,100 @@ int main(int argc, char* argv[]){
         }
     }
 
-    for (std::string& fname : filenames){
+    std::vector<vmFile> program;
+    for (const std::string& fname : filenames){
         Parser parser(fname);
-        fname = getFilenameFromPath(fname);
-        writer.setFileName(fname);
+        vmFile file;
+        file.name = getFilenameFromPath(fname);
         while (parser.hasMoreLines()){
             parser.parse();
-            if (parser.commandType() == C_PUSH || parser.commandType() == C_POP){
-                writer.writePushPop(parser.commandType(), parser.arg1(), parser.arg2());
-            }
-            else if (parser.commandType() == C_ARITHMETIC){
-                writer.writeArithmetic(parser.arg1());
-            }
-            else if (parser.commandType() == C_LABEL){
-                writer.writeLabel(parser.arg1());
-            }
-            else if (parser.commandType() == C_GOTO){
-                writer.writeGoto(parser.arg1());
-            }
-            else if (parser.commandType() == C_IF_GOTO){
-                writer.writeIf(parser.arg1());
-            }
-            else if (parser.commandType() == C_FUNCTION){
-                writer.writeFunction(parser.arg1(), std::stoi(parser.arg2()));
-            }
-            else if (parser.commandType() == C_CALL){
-                writer.writeCall(parser.arg1(), std::stoi(parser.arg2()));
-            }
-            else if (parser.commandType() == C_RETURN){
-                writer.writeReturn();
+            if (parser.commandType() != INVALID){
+                file.commands.push_back({parser.commandType(), parser.arg1(), parser.arg2(), parser.lineNumber()});
             }
         }
+        program.push_back(file);
+    }
+
+    std::unordered_map<std::string, int> register_args;
+    if (inline_mode){
+        TRACE_SCOPE("translator inlining");
+        int rom_before = romSize(program, register_args);
+        Inliner inliner(program);
+        inliner.run();
+        int rom_after = romSize(program, register_args);
+        for (const auto& function : inliner.inlinedPerFunction()){
+            std::cout << "inlined " << function.first << " at " << function.second << " call site(s)\n";
+        }
+        std::cout << "inlined call sites: " << inliner.inlinedCalls() << "\n"
+                  << "ROM size: " << rom_before << " -> " << rom_after << " (" << rom_after - rom_before << ")\n";
+    }
+
+    if (tail_calls){    // after inlining, which only takes callees without calls
+        std::cout << "tail calls: " << markTailCalls(program) << "\n";
+    }
+
+    if (register_mode){     // after inlining, which can turn callers into leaves
+        TRACE_SCOPE("translator call graph");
+        CallGraph call_graph(program);
+        register_args = call_graph.registerFunctions();
+        std::cout << "register functions: " << register_args.size() << "\n";
+        if (call_graph.leftOut())   std::cout << "left on the stack for lack of RAM: " << call_graph.leftOut() << "\n";
+    }
+
+    if (split){     // one asm file per .vm file for separate assembly, printed in link order
+        fs::path directory = path.substr(path.size() - 2, 2) == "vm" ? fs::path(path).parent_path() : fs::path(path);
+        auto writePart = [](const std::string& filename, auto write){
+            std::ofstream outfile(filename);
+            CodeWriter part(outfile.rdbuf());
+            write(part);
+            std::cout << filename << "\n";
+        };
+        if (definesFunction(program, "Sys.init")){
+            writePart((directory / "_bootstrap.asm").string(), [](CodeWriter& part){ part.writeBootstrap(); });
+        }
+        for (size_t i = 0; i < program.size(); i++){
+            writePart(filenames[i].substr(0, filenames[i].size() - 3) + ".asm", [&](CodeWriter& part){
+                part.setRegisterFunctions(register_args);
+                writeFile(part, program[i]);
+            });
+        }
+        writePart((directory / "_end.asm").string(), [](CodeWriter& part){ part.writeClosing(); });
+        return 0;
+    }
+
+    CodeWriter writer(argv[1]);
+    writer.setRegisterFunctions(register_args);
+    if (map){   // cached fragments carry no line information, so a mapped build always translates everything
+        std::ofstream map_file(writer.filename() + ".map");
+        writeProgram(writer, program, &map_file);
+        return 0;
+    }
+    if (!incremental){
+        writeProgram(writer, program);
+        return 0;
+    }
+
+    fragmentCache cache(((path.substr(path.size() - 2, 2) == "vm" ? fs::path(path).parent_path() : fs::path(path)) / ".translator_cache").string());
+    int translated = 0, reused = 0;
+    if (definesFunction(program, "Sys.init"))   writer.writeBootstrap();
+    for (const vmFile& file : program){
+        uint64_t key = fragmentKey(file, register_args);
+        const std::string* fragment = cache.find(file.name, key);
+        if (fragment != nullptr){
+            writer.writeFragment(*fragment);
+            ++reused;
+            continue;
+        }
+        std::stringbuf buffer;
+        CodeWriter fragment_writer(&buffer);
+        fragment_writer.setRegisterFunctions(register_args);
+        writeFile(fragment_writer, file);
+        cache.store(file.name, key, buffer.str());
+        writer.writeFragment(buffer.str());
+        ++translated;
     }
     writer.writeClosing();
+    cache.save();
+    std::cout << "translated " << translated << ", reused " << reused << "\n";
     return 0;
-}
\ No newline at end of file
+}
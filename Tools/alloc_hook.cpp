@@ -0,0 +1,27 @@
+#include <cstdlib>
+#include <new>
+
+#include "alloc_hook.h"
+
+namespace alloc_hook {
+
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocated_bytes{0};
+
+}
+
+void* operator new(size_t size){
+    alloc_hook::allocations.fetch_add(1, std::memory_order_relaxed);
+    alloc_hook::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* block = std::malloc(size == 0 ? 1 : size);
+    if (block == nullptr)   throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void* block) noexcept {
+    std::free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    std::free(block);
+}
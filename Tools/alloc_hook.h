@@ -0,0 +1,21 @@
+#ifndef ALLOC_HOOK_H
+#define ALLOC_HOOK_H
+
+// Allocation counters kept by the global operator new of Tools/alloc_hook.cpp. The operators live in a
+// translation unit of their own: inlined next to the standard library's allocations, their malloc and
+// free would not match the new and delete GCC sees there (-Wmismatched-new-delete). A tool that reads
+// the counters is linked with it:
+//
+//      g++ -O2 -std=c++17 -DTRACE Tools/toolchain.cpp Tools/alloc_hook.cpp -o toolchain
+
+#include <atomic>
+#include <cstddef>
+
+namespace alloc_hook {
+
+extern std::atomic<size_t> allocations;
+extern std::atomic<size_t> allocated_bytes;
+
+}
+
+#endif
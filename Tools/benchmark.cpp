@@ -0,0 +1,277 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <stdlib.h>
+#include <ctype.h>
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <string_view>
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "alloc_hook.h"
+
+// every tool is linked in under its own namespace and run in a forked child, so each run gets its own
+// peak RSS from wait4() and its own allocation counters from Tools/alloc_hook.cpp, which is linked in:
+//
+//      g++ -O2 -std=c++17 Tools/benchmark.cpp Tools/alloc_hook.cpp -o benchmark
+#define main assembler_main
+namespace hack {
+#include "../Project 6/assembler.cpp"
+}
+#undef main
+
+#define main translator_main
+namespace vm7 {
+#include "../Project 7/translator.cpp"
+}
+#undef main
+
+#define main translator_main
+namespace vm {
+#include "../Project 8/translator_complete.cpp"
+}
+#undef main
+
+#define main analyzer_main
+namespace xml {
+#include "../Project 10/analyzer.cpp"
+}
+#undef main
+
+#define main compiler_main
+namespace jack {
+#include "../Project 11/compiler.cpp"
+}
+#undef main
+
+namespace fs = std::filesystem;
+
+#define ASM_LINES (10000)       // per unit of scale
+#define VM_FILES (10)
+#define VM_FUNCTIONS (20)       // per .vm file
+#define JACK_CLASSES (10)
+#define JACK_FUNCTIONS (10)     // per class
+#define EXPRESSION_DEPTH (12)   // nesting of the generated Jack expressions
+
+class corpusGenerator{      // deterministic synthetic inputs, sized by a single scale factor
+    public:
+        corpusGenerator(const std::string& directory, int scale) : m_directory(directory), m_scale(scale){}
+
+        void generate(){
+            fs::create_directories(m_directory + "/asm");
+            fs::create_directories(m_directory + "/vm7");
+            fs::create_directories(m_directory + "/vm");
+            fs::create_directories(m_directory + "/classes");
+            generateAsm(m_directory + "/asm/Corpus.asm");
+            generateStackVm(m_directory + "/vm7/Corpus.vm");
+            for (int i = 0; i < VM_FILES * m_scale; i++)        generateVm(m_directory + "/vm/File" + std::to_string(i) + ".vm", i);
+            for (int i = 0; i < JACK_CLASSES * m_scale; i++)    generateJack(m_directory + "/classes/Class" + std::to_string(i) + ".jack", i);
+        }
+
+    private:
+        void generateAsm(const std::string& filename){      // label dense, like translator output
+            std::ofstream outfile(filename);
+            for (int i = 0; i < ASM_LINES * m_scale / 10; i++){
+                outfile << "(L" << i << ")\n"
+                        << "@SP\n"
+                        << "AM=M-1\n"
+                        << "D=M\n"
+                        << "@var" << i % 97 << "\n"
+                        << "M=D+M\n"
+                        << "@" << i % 32768 << "\n"
+                        << "D=A\n"
+                        << "@L" << (i * 7 + 3) % (ASM_LINES * m_scale / 10) << "\n"
+                        << "D;JGT\n";
+            }
+        }
+
+        void generateStackVm(const std::string& filename){    // push, pop and arithmetic only, for the Project 7 translator
+            std::ofstream outfile(filename);
+            const char* ops[] = {"add", "sub", "neg", "eq", "gt", "lt", "and", "or", "not"};
+            for (int i = 0; i < ASM_LINES * m_scale / 4; i++){
+                outfile << "push constant " << i % 100 << "\n"
+                        << "push local " << i % 8 << "\n"
+                        << ops[i % 9] << "\n"
+                        << "pop argument " << i % 4 << "\n";
+            }
+        }
+
+        void generateVm(const std::string& filename, int file_index){
+            std::ofstream outfile(filename);
+            for (int f = 0; f < VM_FUNCTIONS; f++){
+                outfile << "function File" << file_index << ".f" << f << " 4\n";
+                for (int i = 0; i < 10; i++){
+                    outfile << "label LOOP_" << i << "\n"
+                            << "push argument 0\n"
+                            << "push local " << i % 4 << "\n"
+                            << "add\n"
+                            << "pop local " << (i + 1) % 4 << "\n"
+                            << "push this " << i % 3 << "\n"
+                            << "push constant " << i << "\n"
+                            << "lt\n"
+                            << "if-goto LOOP_" << i << "\n"
+                            << "push local 0\n"
+                            << "call File" << (file_index + 1) % (VM_FILES * m_scale) << ".f" << (f + 1) % VM_FUNCTIONS << " 1\n"
+                            << "pop temp 0\n";
+                }
+                outfile << "push local 0\n"
+                        << "return\n";
+            }
+        }
+
+        std::string expression(int depth, unsigned seed){    // nested binary expression over the subroutine's variables
+            const char* terms[] = {"x", "y", "i", "t", "a", "b", "arr[i]", "3", "17"};
+            const char* ops[] = {" + ", " - ", " * ", " / ", " & ", " | "};
+            if (depth == 0)     return terms[seed % 9];
+            return "(" + expression(depth - 1, seed * 7 + 1) + ops[seed % 6] + terms[(seed / 3) % 9] + ")";
+        }
+
+        void generateJack(const std::string& filename, int class_index){
+            std::string name = "Class" + std::to_string(class_index);
+            std::ofstream outfile(filename);
+            outfile << "class " << name << " {\n"
+                    << "    field int a, b;\n"
+                    << "    static int s;\n"
+                    << "    constructor " << name << " new(int x) {\n"
+                    << "        let a = x;\n"
+                    << "        let b = x + 1;\n"
+                    << "        return this;\n"
+                    << "    }\n"
+                    << "    method int getA() {\n"
+                    << "        return a;\n"
+                    << "    }\n";
+            for (int f = 0; f < JACK_FUNCTIONS; f++){
+                outfile << "    method int f" << f << "(int x, int y) {\n"
+                        << "        var int i, t;\n"
+                        << "        var Array arr;\n"
+                        << "        let arr = Array.new(10);\n"
+                        << "        let i = 0;\n"
+                        << "        while (i < 10) {\n"
+                        << "            let arr[i] = " << expression(EXPRESSION_DEPTH, class_index * 31 + f) << ";\n"
+                        << "            if (i > 5) {\n"
+                        << "                let t = t + " << expression(EXPRESSION_DEPTH / 2, f) << ";\n"
+                        << "            }\n"
+                        << "            else {\n"
+                        << "                let t = t - getA();\n"
+                        << "            }\n"
+                        << "            let i = i + 1;\n"
+                        << "        }\n"
+                        << "        do Output.printString(\"done\");\n"
+                        << "        return t;\n"
+                        << "    }\n";
+            }
+            outfile << "}\n";
+        }
+
+        std::string         m_directory;
+        int                 m_scale;
+};
+
+struct runResult{
+    double              seconds;
+    long                peak_rss_kb;
+    size_t              allocations;
+    size_t              allocated_bytes;
+    int                 exit_code;
+};
+
+runResult runTool(std::function<int(int, char**)> tool, const std::string& path){
+    int counters[2];
+    if (pipe(counters) != 0)    std::exit(1);
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0){
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        std::string tool_name = "tool";
+        std::vector<char*> argv = {&tool_name[0], const_cast<char*>(path.c_str()), nullptr};
+        alloc_hook::allocations = 0;
+        alloc_hook::allocated_bytes = 0;
+        int exit_code = tool(2, argv.data());
+        std::cout.flush();
+        size_t totals[2] = {alloc_hook::allocations.load(), alloc_hook::allocated_bytes.load()};
+        ssize_t written = write(counters[1], totals, sizeof(totals));
+        _exit(written == sizeof(totals) ? exit_code : 1);
+    }
+    close(counters[1]);
+    runResult result;
+    size_t totals[2] = {0, 0};
+    if (read(counters[0], totals, sizeof(totals)) != sizeof(totals))    totals[0] = totals[1] = 0;
+    close(counters[0]);
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.peak_rss_kb = usage.ru_maxrss;
+    result.allocations = totals[0];
+    result.allocated_bytes = totals[1];
+    result.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return result;
+}
+
+void measureInput(const std::string& path, const std::string& ext, size_t& lines, size_t& bytes){
+    lines = bytes = 0;
+    std::vector<fs::path> files;
+    if (fs::is_directory(path)){
+        for (const auto& fpath : fs::directory_iterator(path)){
+            if (fpath.path().extension() == ext)    files.push_back(fpath.path());
+        }
+    }
+    else    files.push_back(path);
+    for (const fs::path& file : files){
+        std::string content = jack::readFile(file.string());
+        bytes += content.size();
+        lines += std::count(content.begin(), content.end(), '\n');
+    }
+}
+
+void report(const std::string& tool, const std::string& path, const std::string& ext, int scale, const runResult& result){
+    size_t lines, bytes;
+    measureInput(path, ext, lines, bytes);
+    std::cout << "{\"tool\": \"" << tool << "\""
+              << ", \"scale\": " << scale
+              << ", \"input_lines\": " << lines
+              << ", \"input_bytes\": " << bytes
+              << ", \"seconds\": " << result.seconds
+              << ", \"lines_per_s\": " << lines / result.seconds
+              << ", \"mb_per_s\": " << bytes / result.seconds / 1e6
+              << ", \"peak_rss_kb\": " << result.peak_rss_kb
+              << ", \"allocations\": " << result.allocations
+              << ", \"allocated_bytes\": " << result.allocated_bytes
+              << ", \"exit_code\": " << result.exit_code << "}" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    if (argc < 2 || argc > 3){      // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    std::string directory(argv[1]);
+    int scale = argc == 3 ? std::stoi(argv[2]) : 1;
+    corpusGenerator generator(directory, scale);
+    generator.generate();
+
+    report("assembler", directory + "/asm/Corpus.asm", ".asm", scale, runTool(hack::assembler_main, directory + "/asm/Corpus.asm"));
+    report("translator", directory + "/vm7/Corpus.vm", ".vm", scale, runTool(vm7::translator_main, directory + "/vm7/Corpus.vm"));
+    report("translator_complete", directory + "/vm/", ".vm", scale, runTool(vm::translator_main, directory + "/vm/"));
+    report("analyzer", directory + "/classes", ".jack", scale, runTool(xml::analyzer_main, directory + "/classes"));
+    report("compiler", directory + "/classes", ".jack", scale, runTool(jack::compiler_main, directory + "/classes"));
+    return 0;
+}
@@ -0,0 +1,1448 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <tuple>
+
+namespace fs = std::filesystem;
+
+#define RAM_SIZE (32768)
+#define DEFAULT_MAX_CYCLES (1000000000LL)   // programs that never reach the END loop stop here
+#define REPORT_TOP (20)                     // rows in each profile table
+#define HEAP_BASE (2048)
+#define HEAP_END (16384)
+#define MISMATCH_REPORTS (10)               // validation mismatches printed in full
+#define KBD (24576)
+#define BATCH_CHUNK (16)                    // instances a batch worker claims at a time
+#define LANES (16)                          // machines in a lockstep group, 16 words of 16 bits fill an AVX2 register
+#define SCREEN (16384)
+#define SCREEN_WIDTH (512)
+#define SCREEN_HEIGHT (256)
+#define ROW_WORDS (32)                      // screen words per row of pixels
+#define FRAME_CYCLES (100000)               // cycles per captured frame
+#define SNAPSHOT_CYCLES (10000000)          // cycles between snapshots
+#define SNAPSHOT_KEYFRAME (16)              // every 16th snapshot is stored whole, the rest against the one before
+
+struct instruction{     // a ROM word, decoded once at load time
+    bool                is_address;     // A-instruction
+    uint16_t            value;          // constant of an A-instruction
+    uint8_t             comp;           // a bit and c1-c6
+    uint8_t             dest;           // A, D, M bits
+    uint8_t             jump;           // lt, eq, gt bits
+};
+
+instruction decode(uint16_t word){
+    if ((word & 0x8000) == 0)   return {true, word, 0, 0, 0};
+    return {false, 0, (uint8_t)((word >> 6) & 0x7f), (uint8_t)((word >> 3) & 0x7), (uint8_t)(word & 0x7)};
+}
+
+inline int16_t alu(int16_t x, int16_t y, int control){     // zx nx zy ny f no, exactly as in ALU.hdl
+    if (control & 0x20)     x = 0;
+    if (control & 0x10)     x = ~x;
+    if (control & 0x08)     y = 0;
+    if (control & 0x04)     y = ~y;
+    int16_t out = (control & 0x02) ? (int16_t)(x + y) : (int16_t)(x & y);
+    if (control & 0x01)     out = ~out;
+    return out;
+}
+
+inline bool jumps(int16_t out, int condition){
+    return ((condition & 0x4) && out < 0) || ((condition & 0x2) && out == 0) || ((condition & 0x1) && out > 0);
+}
+
+uint64_t ramDigest(const int16_t* ram){     // FNV-1a over all of RAM, taken four words at a time
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < RAM_SIZE; i += 4){
+        uint64_t chunk;
+        std::memcpy(&chunk, &ram[i], sizeof(chunk));
+        hash ^= chunk;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::vector<instruction> loadRom(const std::string& filename){
+    std::ifstream infile(filename);
+    if (!infile.is_open()){
+        std::cout << "cannot open " << filename << "\n";
+        std::exit(1);
+    }
+    std::vector<instruction> rom;
+    std::string line;
+    while (std::getline(infile, line)){
+        if (line.size() >= 16)      rom.push_back(decode(std::stoi(line.substr(0, 16), nullptr, 2)));
+    }
+    return rom;
+}
+
+struct noObserver{
+    void onJump(uint16_t, uint16_t){}
+    void onCycle(uint16_t){}
+    void onWrite(uint16_t){}
+};
+
+struct snapshot{        // all a machine needs to carry on from a cycle
+    int16_t                 a;
+    int16_t                 d;
+    uint16_t                pc;
+    long long               cycles;
+    bool                    halted;
+    std::vector<int16_t>    ram;
+};
+
+class hackMachine{      // the Hack CPU of Project 5, one instruction per cycle
+    public:
+        hackMachine(const std::vector<instruction>& rom) : m_rom(rom), m_ram(RAM_SIZE, 0){}
+
+        // runs until the program reaches its END loop ("(END) @END 0;JMP"), leaves the ROM or uses up its cycles
+        template <typename Observer>
+        long long run(long long max_cycles, Observer& observer){
+            if (m_halted)   return 0;
+            long long cycles = 0;
+            while (cycles < max_cycles && m_pc < m_rom.size()){
+                uint16_t pc = m_pc;
+                observer.onCycle(pc);
+                ++cycles;
+                const instruction& current = m_rom[pc];
+                if (current.is_address){
+                    m_a = current.value;
+                    ++m_pc;
+                    continue;
+                }
+                uint16_t address = m_a & (RAM_SIZE - 1);
+                int16_t out = alu(m_d, (current.comp & 0x40) ? m_ram[address] : m_a, current.comp & 0x3f);
+                if (current.dest & 0x1){
+                    m_ram[address] = out;
+                    observer.onWrite(address);
+                }
+                if (current.dest & 0x2)     m_d = out;
+                if (current.dest & 0x4)     m_a = out;
+                if (current.jump && jumps(out, current.jump)){
+                    m_pc = m_a;
+                    if (m_on_jump)      m_on_jump(*this, pc);
+                    if (m_halted)       break;
+                    observer.onJump(pc, m_pc);
+                    if (m_pc + 1 == pc && m_rom[m_pc].is_address && m_rom[m_pc].value == m_pc){
+                        m_halted = true;
+                        break;
+                    }
+                }
+                else    ++m_pc;
+            }
+            m_cycles += cycles;
+            return cycles;
+        }
+
+        bool halted() const {
+            return m_halted;
+        }
+
+        long long cycles() const {
+            return m_cycles;
+        }
+
+        int16_t ram(int address) const {
+            return m_ram[address];
+        }
+
+        void reset(){
+            std::fill(m_ram.begin(), m_ram.end(), 0);
+            m_a = m_d = 0;
+            m_pc = 0;
+            m_cycles = 0;
+            m_halted = false;
+        }
+
+        uint64_t digest() const {
+            return ramDigest(m_ram.data());
+        }
+
+        std::vector<int16_t>& memory(){
+            return m_ram;
+        }
+
+        uint16_t pc() const {
+            return m_pc;
+        }
+
+        void setPc(uint16_t pc){
+            m_pc = pc;
+        }
+
+        void halt(){
+            m_halted = true;
+        }
+
+        snapshot save() const {
+            return {m_a, m_d, m_pc, m_cycles, m_halted, m_ram};
+        }
+
+        void restore(const snapshot& state){
+            m_ram = state.ram;
+            m_a = state.a;
+            m_d = state.d;
+            m_pc = state.pc;
+            m_cycles = state.cycles;
+            m_halted = state.halted;
+        }
+
+        void setState(int16_t a, int16_t d, uint16_t pc, long long cycles){    // resumes a machine mid run
+            m_a = a;
+            m_d = d;
+            m_pc = pc;
+            m_cycles = cycles;
+        }
+
+        void onJump(std::function<void(hackMachine&, uint16_t)> hook){    // called after every jump taken, may redirect the machine
+            m_on_jump = hook;
+        }
+
+        void onWrite(std::function<void(uint16_t)> hook){      // called on every poke()
+            m_on_write = hook;
+        }
+
+        void poke(uint16_t address, int16_t value){     // a write from outside the CPU that observers should see
+            m_ram[address] = value;
+            if (m_on_write)     m_on_write(address);
+        }
+
+    private:
+        const std::vector<instruction>&     m_rom;
+        std::vector<int16_t>                m_ram;
+        std::function<void(hackMachine&, uint16_t)>     m_on_jump;
+        std::function<void(uint16_t)>                   m_on_write;
+        int16_t                             m_a = 0;
+        int16_t                             m_d = 0;
+        uint16_t                            m_pc = 0;
+        long long                           m_cycles = 0;
+        bool                                m_halted = false;
+};
+
+struct sourceLocation{
+    int                 function;       // index into the function names
+    std::string         kind;           // call, tail (a call that replaces the caller's frame), return or code
+    std::string         callee;         // of a call or tail call
+    std::string         vm_file;
+    int                 vm_line;
+    std::string         jack_file;      // empty when the .vm file has no map of its own
+    int                 jack_line;
+};
+
+// joins the three source maps the toolchain writes with --map: Prog.hack.map (ROM address -> asm line),
+// Prog.asm.map (asm lines -> VM command) and Class.vm.map (VM line -> Jack line) next to the .vm files
+class sourceMap{
+    public:
+        sourceMap(const std::string& hack_file, size_t rom_size){
+            m_functions.push_back("(bootstrap)");
+            m_locations.push_back({0, "call", "", "", 0, "", 0});   // ROM words outside any VM command
+            m_at.assign(rom_size, 0);
+            std::string base = hack_file.substr(0, hack_file.size() - 5);
+            std::ifstream rom_map(base + ".hack.map"), asm_map(base + ".asm.map");
+            if (!rom_map.is_open() || !asm_map.is_open()){
+                std::cout << "missing " << base << ".hack.map or " << base << ".asm.map\n";
+                std::exit(1);
+            }
+
+            std::vector<int> location_of_line;      // asm line -> location
+            std::unordered_map<std::string, int> function_index;
+            std::string line;
+            while (std::getline(asm_map, line)){
+                std::stringstream fields(line);
+                size_t first, last;
+                sourceLocation location;
+                std::string function;
+                fields >> first >> last >> location.vm_file >> location.vm_line >> function >> location.kind >> location.callee;
+                if (function_index.find(function) == function_index.end()){
+                    function_index[function] = m_functions.size();
+                    m_functions.push_back(function);
+                }
+                location.function = function_index[function];
+                location.jack_line = jackLine(fs::path(hack_file).parent_path(), location.vm_file, location.vm_line, location.jack_file);
+                if (location_of_line.size() <= last)    location_of_line.resize(last + 1, 0);
+                for (size_t i = first; i <= last; i++)  location_of_line[i] = m_locations.size();
+                m_locations.push_back(location);
+            }
+
+            m_entry.assign(m_functions.size(), -1);
+            size_t address = 0, asm_line;
+            while (rom_map >> asm_line && address < rom_size){
+                int location = asm_line < location_of_line.size() ? location_of_line[asm_line] : 0;
+                m_at[address] = location;
+                int function = m_locations[location].function;
+                if (m_entry[function] == -1)    m_entry[function] = address;
+                ++address;
+            }
+        }
+
+        const sourceLocation& at(uint16_t address) const {
+            return m_locations[address < m_at.size() ? m_at[address] : 0];
+        }
+
+        bool isEntry(uint16_t address) const {
+            return m_entry[at(address).function] == address;
+        }
+
+        const std::string& functionName(int function) const {
+            return m_functions[function];
+        }
+
+        bool defines(const std::string& function) const {
+            auto found = std::find(m_functions.begin(), m_functions.end(), function);
+            return found != m_functions.end() && m_entry[found - m_functions.begin()] != -1;
+        }
+
+        size_t romSize() const {
+            return m_at.size();
+        }
+
+    private:
+        int jackLine(const fs::path& directory, const std::string& vm_file, int vm_line, std::string& jack_file){
+            auto cached = m_jack_lines.find(vm_file);
+            if (cached == m_jack_lines.end()){
+                std::vector<int> lines;
+                std::ifstream vm_map((directory / (vm_file + ".map")).string());
+                std::string source;
+                if (std::getline(vm_map, source)){
+                    lines.push_back(0);     // VM lines count from 1
+                    int jack_line;
+                    while (vm_map >> jack_line)     lines.push_back(jack_line);
+                }
+                m_jack_files[vm_file] = source;
+                cached = m_jack_lines.emplace(vm_file, lines).first;
+            }
+            jack_file = m_jack_files[vm_file];
+            return (size_t)vm_line < cached->second.size() ? cached->second[vm_line] : 0;
+        }
+
+        std::vector<std::string>                                m_functions;
+        std::vector<sourceLocation>                             m_locations;
+        std::vector<int>                                        m_at;           // ROM address -> location
+        std::vector<int>                                        m_entry;        // function -> first ROM address
+        std::unordered_map<std::string, std::vector<int>>       m_jack_lines;   // .vm file -> Jack line per VM line
+        std::unordered_map<std::string, std::string>            m_jack_files;
+};
+
+class profiler{     // cycles per ROM address under the VM call stack that was live when they ran
+    public:
+        profiler(const sourceMap& map) : m_map(map){
+            m_nodes.push_back({-1, 0, {}});
+        }
+
+        void onCycle(uint16_t pc){
+            ++m_counts[((uint64_t)m_current << 16) | pc];
+        }
+
+        void onJump(uint16_t from, uint16_t to){
+            const std::string& kind = m_map.at(from).kind;
+            if (kind == "call" && m_map.isEntry(to))    m_current = child(m_current, m_map.at(to).function);
+            else if (kind == "tail" && m_map.isEntry(to))   m_current = child(std::max(m_nodes[m_current].parent, 0), m_map.at(to).function);
+            else if (kind == "return"){
+                int function = m_map.at(to).function;   // unwinds to the caller even if frames were skipped
+                int node = m_nodes[m_current].parent;
+                while (node > 0 && m_nodes[node].function != function)     node = m_nodes[node].parent;
+                m_current = node > 0 ? node : child(0, function);
+            }
+        }
+
+        void onWrite(uint16_t){}
+
+        // folded stacks, one "frame;frame;frame cycles" line per stack, as read by flamegraph.pl and speedscope
+        void writeFolded(const std::string& filename, bool lines){
+            std::unordered_map<std::string, long long> folded;
+            for (const auto& count : m_counts){
+                int node = count.first >> 16;
+                const sourceLocation& location = m_map.at(count.first & 0xffff);
+                std::string stack = stackName(node);
+                if (lines && location.vm_file != "")    stack += ";" + lineName(location);
+                folded[stack] += count.second;
+            }
+            std::vector<std::pair<std::string, long long>> sorted(folded.begin(), folded.end());
+            std::sort(sorted.begin(), sorted.end());
+            std::ofstream outfile(filename);
+            for (const auto& stack : sorted)    outfile << stack.first << " " << stack.second << "\n";
+        }
+
+        void printReport(long long total){
+            std::unordered_map<std::string, long long> functions, lines;
+            for (const auto& count : m_counts){
+                const sourceLocation& location = m_map.at(count.first & 0xffff);
+                functions[m_map.functionName(location.function)] += count.second;
+                lines[lineName(location)] += count.second;
+            }
+            printTable("function (self cycles)", functions, total);
+            printTable("source line", lines, total);
+        }
+
+    private:
+        struct node{
+            int                             parent;
+            int                             function;
+            std::unordered_map<int, int>    children;
+        };
+
+        int child(int parent, int function){
+            auto existing = m_nodes[parent].children.find(function);
+            if (existing != m_nodes[parent].children.end())     return existing->second;
+            m_nodes.push_back({parent, function, {}});
+            m_nodes[parent].children[function] = m_nodes.size() - 1;
+            return m_nodes.size() - 1;
+        }
+
+        std::string stackName(int node){
+            std::string stack;
+            for (; node > 0; node = m_nodes[node].parent){
+                stack = m_map.functionName(m_nodes[node].function) + (stack.empty() ? "" : ";") + stack;
+            }
+            return stack.empty() ? m_map.functionName(0) : stack;
+        }
+
+        std::string lineName(const sourceLocation& location){
+            if (!location.jack_file.empty())    return location.jack_file + ":" + std::to_string(location.jack_line);
+            if (!location.vm_file.empty())      return location.vm_file + ":" + std::to_string(location.vm_line);
+            return m_map.functionName(location.function);
+        }
+
+        void printTable(const std::string& title, const std::unordered_map<std::string, long long>& rows, long long total){
+            std::vector<std::pair<long long, std::string>> sorted;
+            for (const auto& row : rows)    sorted.push_back({row.second, row.first});
+            std::sort(sorted.rbegin(), sorted.rend());
+            std::cout << "\n" << std::left << std::setw(48) << title << std::right << std::setw(14) << "cycles" << std::setw(9) << "%" << "\n";
+            for (size_t i = 0; i < sorted.size() && i < REPORT_TOP; i++){
+                std::cout << std::left << std::setw(48) << sorted[i].second << std::right << std::setw(14) << sorted[i].first
+                          << std::setw(9) << std::fixed << std::setprecision(2) << 100.0 * sorted[i].first / total << "\n";
+            }
+        }
+
+        const sourceMap&                                m_map;
+        std::vector<node>                               m_nodes;        // call tree, 0 is the root
+        int                                             m_current = 0;
+        std::unordered_map<uint64_t, long long>         m_counts;       // node << 16 | ROM address -> cycles
+};
+
+// Jack OS functions (Math, Memory, Array, String) run natively: arguments are read from the callee frame the call sequence has just
+// built, and the frame is torn down exactly as the VM return would do it. Math is pure; Memory keeps its
+// free list inside the heap and String its fields in heap objects ([0] chars, [1] length, [2] capacity),
+// laid out word for word like the Jack implementation's. Whether the heap has been set up is up to
+// nativeRuntime, as a flag in RAM would differ from Jack. A class is hooked as a whole.
+struct nativeFunction{
+    int                 n_args;
+    int16_t             (*run)(hackMachine& machine, const int16_t* args);
+    bool                heap = false;   // needs the heap set up, which it is on first use without Memory.init
+};
+
+static std::unordered_map<std::string, nativeFunction> native_table;
+
+int16_t sysError(hackMachine& machine, int code){     // what Sys.error would print before halting
+    std::cout << "ERR" << code << "\n";
+    machine.halt();
+    return 0;
+}
+
+void heapInit(std::vector<int16_t>& ram){     // an empty sentinel segment, then one free segment over the rest of the heap
+    ram[HEAP_BASE] = 0;
+    ram[HEAP_BASE + 1] = HEAP_BASE + 2;
+    ram[HEAP_BASE + 2] = HEAP_END - HEAP_BASE - 4;  // free words after the segment's [size, next] header
+    ram[HEAP_BASE + 3] = 0;
+}
+
+int16_t heapAlloc(hackMachine& machine, int size){  // first fit, carving blocks off the end of a segment
+    std::vector<int16_t>& ram = machine.memory();
+    if (size <= 0)      return sysError(machine, 5);
+    int previous = HEAP_BASE;
+    for (int segment = ram[HEAP_BASE + 1]; segment != 0; segment = ram[segment + 1]){
+        if (ram[segment] >= size + 2){
+            ram[segment] -= size + 2;
+            int block = segment + 2 + ram[segment];
+            ram[block] = size;
+            ram[block + 1] = 0;
+            return block + 2;
+        }
+        if (ram[segment] >= size){
+            ram[previous + 1] = ram[segment + 1];
+            return segment + 2;
+        }
+        previous = segment;
+    }
+    return sysError(machine, 6);
+}
+
+void heapFree(hackMachine& machine, int block){
+    std::vector<int16_t>& ram = machine.memory();
+    ram[block - 1] = ram[HEAP_BASE + 1];
+    ram[HEAP_BASE + 1] = block - 2;
+}
+
+int16_t mathInit(hackMachine&, const int16_t*)              { return 0; }
+int16_t mathAbs(hackMachine&, const int16_t* args)          { return args[0] < 0 ? -args[0] : args[0]; }
+int16_t mathMin(hackMachine&, const int16_t* args)          { return std::min(args[0], args[1]); }
+int16_t mathMax(hackMachine&, const int16_t* args)          { return std::max(args[0], args[1]); }
+int16_t mathMultiply(hackMachine&, const int16_t* args)     { return (int16_t)(args[0] * args[1]); }
+
+int16_t mathDivide(hackMachine& machine, const int16_t* args){
+    if (args[1] == 0)   return sysError(machine, 3);
+    return (int16_t)(args[0] / args[1]);
+}
+
+int16_t mathSqrt(hackMachine& machine, const int16_t* args){
+    if (args[0] < 0)    return sysError(machine, 4);
+    int root = 0;
+    while ((root + 1) * (root + 1) <= args[0])      ++root;
+    return root;
+}
+
+int16_t memoryInit(hackMachine& machine, const int16_t*){
+    heapInit(machine.memory());
+    return 0;
+}
+
+int16_t memoryPeek(hackMachine& machine, const int16_t* args){
+    return machine.ram((uint16_t)args[0] & (RAM_SIZE - 1));
+}
+
+int16_t memoryPoke(hackMachine& machine, const int16_t* args){
+    machine.poke((uint16_t)args[0] & (RAM_SIZE - 1), args[1]);
+    return 0;
+}
+
+int16_t memoryAlloc(hackMachine& machine, const int16_t* args){
+    return heapAlloc(machine, args[0]);
+}
+
+int16_t memoryDeAlloc(hackMachine& machine, const int16_t* args){
+    heapFree(machine, args[0]);
+    return 0;
+}
+
+int16_t arrayNew(hackMachine& machine, const int16_t* args){
+    return heapAlloc(machine, args[0]);
+}
+
+int16_t stringNew(hackMachine& machine, const int16_t* args){
+    if (args[0] < 0)    return sysError(machine, 14);
+    int16_t object = heapAlloc(machine, 3);
+    int16_t chars = (args[0] > 0 && !machine.halted()) ? heapAlloc(machine, args[0]) : 0;
+    if (machine.halted())   return 0;
+    std::vector<int16_t>& ram = machine.memory();
+    ram[object] = chars;
+    ram[object + 1] = 0;
+    ram[object + 2] = args[0];
+    return object;
+}
+
+int16_t stringDispose(hackMachine& machine, const int16_t* args){
+    if (machine.ram(args[0]) != 0)  heapFree(machine, machine.ram(args[0]));
+    heapFree(machine, args[0]);
+    return 0;
+}
+
+int16_t stringLength(hackMachine& machine, const int16_t* args){
+    return machine.ram(args[0] + 1);
+}
+
+int16_t stringCharAt(hackMachine& machine, const int16_t* args){
+    if (args[1] < 0 || args[1] >= machine.ram(args[0] + 1))     return sysError(machine, 15);
+    return machine.ram(machine.ram(args[0]) + args[1]);
+}
+
+int16_t stringSetCharAt(hackMachine& machine, const int16_t* args){
+    if (args[1] < 0 || args[1] >= machine.ram(args[0] + 1))     return sysError(machine, 16);
+    machine.memory()[machine.ram(args[0]) + args[1]] = args[2];
+    return 0;
+}
+
+int16_t stringAppendChar(hackMachine& machine, const int16_t* args){
+    std::vector<int16_t>& ram = machine.memory();
+    if (ram[args[0] + 1] >= ram[args[0] + 2])   return sysError(machine, 17);
+    ram[ram[args[0]] + ram[args[0] + 1]] = args[1];
+    ++ram[args[0] + 1];
+    return args[0];
+}
+
+int16_t stringEraseLastChar(hackMachine& machine, const int16_t* args){
+    if (machine.ram(args[0] + 1) == 0)  return sysError(machine, 18);
+    --machine.memory()[args[0] + 1];
+    return 0;
+}
+
+int16_t stringIntValue(hackMachine& machine, const int16_t* args){
+    int length = machine.ram(args[0] + 1), chars = machine.ram(args[0]), i = 0, value = 0;
+    bool negative = length > 0 && machine.ram(chars) == '-';
+    for (i = negative ? 1 : 0; i < length && machine.ram(chars + i) >= '0' && machine.ram(chars + i) <= '9'; i++){
+        value = value * 10 + machine.ram(chars + i) - '0';
+    }
+    return (int16_t)(negative ? -value : value);
+}
+
+int16_t stringSetInt(hackMachine& machine, const int16_t* args){
+    std::string digits = std::to_string(args[1]);
+    std::vector<int16_t>& ram = machine.memory();
+    if ((int)digits.size() > ram[args[0] + 2])  return sysError(machine, 19);
+    for (size_t i = 0; i < digits.size(); i++)  ram[ram[args[0]] + i] = digits[i];
+    ram[args[0] + 1] = digits.size();
+    return 0;
+}
+
+int16_t stringNewLine(hackMachine&, const int16_t*)         { return 128; }
+int16_t stringBackSpace(hackMachine&, const int16_t*)       { return 129; }
+int16_t stringDoubleQuote(hackMachine&, const int16_t*)     { return 34; }
+
+void initNativeTable(){
+    native_table["Math.init"]               = {0, mathInit};
+    native_table["Math.abs"]                = {1, mathAbs};
+    native_table["Math.multiply"]           = {2, mathMultiply};
+    native_table["Math.divide"]             = {2, mathDivide};
+    native_table["Math.min"]                = {2, mathMin};
+    native_table["Math.max"]                = {2, mathMax};
+    native_table["Math.sqrt"]               = {1, mathSqrt};
+    native_table["Memory.init"]             = {0, memoryInit, true};
+    native_table["Memory.peek"]             = {1, memoryPeek};
+    native_table["Memory.poke"]             = {2, memoryPoke};
+    native_table["Memory.alloc"]            = {1, memoryAlloc, true};
+    native_table["Memory.deAlloc"]          = {1, memoryDeAlloc, true};
+    native_table["Array.new"]               = {1, arrayNew, true};
+    native_table["Array.dispose"]           = {1, memoryDeAlloc, true};
+    native_table["String.new"]              = {1, stringNew, true};
+    native_table["String.dispose"]          = {1, stringDispose, true};
+    native_table["String.length"]           = {1, stringLength};
+    native_table["String.charAt"]           = {2, stringCharAt};
+    native_table["String.setCharAt"]        = {3, stringSetCharAt};
+    native_table["String.appendChar"]       = {2, stringAppendChar};
+    native_table["String.eraseLastChar"]    = {1, stringEraseLastChar};
+    native_table["String.intValue"]         = {1, stringIntValue};
+    native_table["String.setInt"]           = {2, stringSetInt};
+    native_table["String.newLine"]          = {0, stringNewLine};
+    native_table["String.backSpace"]        = {0, stringBackSpace};
+    native_table["String.doubleQuote"]      = {0, stringDoubleQuote};
+}
+
+class nativeRuntime{    // intercepts calls to native_table functions at their call sites, found through the source map
+    public:
+        nativeRuntime(const sourceMap& map, bool validate) : m_validate(validate), m_hook_at(map.romSize(), -1){
+            std::unordered_map<std::string, int> hook_index;
+            for (size_t address = 0; address < map.romSize(); address++){
+                const sourceLocation& location = map.at(address);
+                if ((location.kind != "call" && location.kind != "tail") || native_table.find(location.callee) == native_table.end())   continue;
+                if (hook_index.find(location.callee) == hook_index.end()){
+                    hook_index[location.callee] = m_hooks.size();
+                    m_hooks.push_back({location.callee, &native_table[location.callee], map.defines(location.callee), 0, 0, 0});
+                }
+                m_hook_at[address] = hook_index[location.callee];   // only the jump of the call sequence ever reaches the hook
+            }
+        }
+
+        void attach(hackMachine& machine){
+            machine.onJump([this](hackMachine& machine, uint16_t from){ onJump(machine, from); });
+            start(machine);
+        }
+
+        // a machine at reset has no heap yet; one restored mid run has, once the free list is linked in
+        void start(const hackMachine& machine){
+            m_heap_ready = machine.ram(HEAP_BASE + 1) != 0;
+        }
+
+        void printReport(){
+            std::cout << "\n" << std::left << std::setw(32) << "native function" << std::right << std::setw(12) << "calls"
+                      << std::setw(12) << "validated" << std::setw(12) << "mismatches" << "\n";
+            for (const hook& h : m_hooks){
+                std::cout << std::left << std::setw(32) << h.name << std::right << std::setw(12) << h.calls
+                          << std::setw(12) << h.validated << std::setw(12) << h.mismatches << "\n";
+            }
+        }
+
+    private:
+        struct hook{
+            std::string             name;
+            const nativeFunction*   function;
+            bool                    in_rom;     // the Jack implementation is linked in, so it can be validated against
+            long long               calls;
+            long long               validated;
+            long long               mismatches;
+        };
+
+        struct pendingCall{     // a validated call whose Jack implementation is still running
+            int                     hook;
+            uint16_t                return_address;
+            int16_t                 sp;         // after the return
+            hackMachine             native;     // the machine as the native call left it
+        };
+
+        void onJump(hackMachine& machine, uint16_t from){
+            if (!m_pending.empty() && machine.pc() == m_pending.back().return_address && machine.ram(0) == m_pending.back().sp){
+                compare(machine, m_pending.back());
+                m_pending.pop_back();
+            }
+            int index = from < m_hook_at.size() ? m_hook_at[from] : -1;
+            if (index == -1)    return;
+            hook& h = m_hooks[index];
+            ++h.calls;
+            if (!m_validate || !h.in_rom){
+                call(machine, *h.function);
+                return;
+            }
+            ++h.validated;
+            hackMachine native(machine);
+            call(native, *h.function);
+            m_pending.push_back({index, native.pc(), native.ram(0), native});
+        }
+
+        void call(hackMachine& machine, const nativeFunction& function){
+            std::vector<int16_t>& ram = machine.memory();
+            int16_t args[3];
+            for (int i = 0; i < function.n_args; i++)   args[i] = ram[(uint16_t)(ram[2] + i)];
+            if (function.heap && !m_heap_ready)     heapInit(ram);
+            m_heap_ready = m_heap_ready || function.heap;   // validated or not, the Jack side has set its heap up too
+            int16_t result = function.run(machine, args);
+            if (machine.halted())   return;
+            // the VM return: result over argument 0, then the caller's frame back from below LCL; the return
+            // address goes first, without arguments argument 0 is its slot
+            int frame = ram[1];
+            uint16_t return_address = ram[frame - 5];
+            ram[(uint16_t)ram[2]] = result;
+            ram[0] = ram[2] + 1;
+            ram[4] = ram[frame - 1];
+            ram[3] = ram[frame - 2];
+            ram[2] = ram[frame - 3];
+            ram[1] = ram[frame - 4];
+            machine.setPc(return_address);
+        }
+
+        // the caller can only observe the pointers, its stack and the heap; temp and R13-R15 are scratch
+        void compare(const hackMachine& machine, const pendingCall& pending){
+            hook& h = m_hooks[pending.hook];
+            std::string difference;
+            int sp = (uint16_t)machine.ram(0);
+            for (int address = 0; address < HEAP_END && difference.empty(); address++){
+                bool observed = address <= 4 || (address >= 256 && address < sp) || address >= HEAP_BASE;
+                if (observed && machine.ram(address) != pending.native.ram(address)){
+                    difference = "RAM[" + std::to_string(address) + "] = " + std::to_string(machine.ram(address))
+                               + ", native " + std::to_string(pending.native.ram(address));
+                }
+            }
+            if (difference.empty())     return;
+            if (++m_mismatches <= MISMATCH_REPORTS)     std::cout << "mismatch in " << h.name << ": " << difference << "\n";
+            ++h.mismatches;
+        }
+
+        bool                            m_validate;
+        std::vector<int>                m_hook_at;      // ROM address -> hook
+        std::vector<hook>               m_hooks;
+        std::vector<pendingCall>        m_pending;
+        long long                       m_mismatches = 0;
+        bool                            m_heap_ready = false;
+};
+
+typedef int16_t laneVector __attribute__((vector_size(LANES * sizeof(int16_t))));
+
+// vectors go by reference so no 32-byte vector crosses a call boundary, whose ABI differs with and without AVX
+static inline void alu(const laneVector& x_in, const laneVector& y_in, int control, laneVector& out){    // the same ALU, for every lane at once
+    laneVector zero = {}, x = x_in, y = y_in;
+    if (control & 0x20)     x = zero;
+    if (control & 0x10)     x = ~x;
+    if (control & 0x08)     y = zero;
+    if (control & 0x04)     y = ~y;
+    out = (control & 0x02) ? x + y : x & y;
+    if (control & 0x01)     out = ~out;
+}
+
+static inline uint32_t laneMask(const laneVector& condition){     // bit per lane of a vector comparison
+    uint32_t mask = 0;
+    for (int lane = 0; lane < LANES; lane++)    mask |= (uint32_t)(condition[lane] & 1) << lane;
+    return mask;
+}
+
+// up to LANES machines running one ROM on different data, one instruction for all of them per step: A, D
+// and the ALU are vectors and RAM is interleaved so a word is one vector across the lanes. The lanes share
+// the PC until a jump sends them different ways; then the largest set that agrees stays in step and the
+// others are split off as scalar machines holding their lane's state
+class lockstepGroup{
+    public:
+        lockstepGroup(const std::vector<instruction>& rom) : m_rom(rom), m_ram(RAM_SIZE){}
+
+        void reset(int lanes){
+            std::fill(m_ram.begin(), m_ram.end(), laneVector{});
+            m_a = m_d = laneVector{};
+            m_a_uniform = true;
+            m_pc = 0;
+            m_cycles = 0;
+            m_halted = false;
+            setActive((1u << lanes) - 1);
+            m_splits.clear();
+            m_lane_cycles = 0;
+        }
+
+        void restore(const snapshot& state){    // every lane from the same state
+            for (int address = 0; address < RAM_SIZE; address++)    m_ram[address] = laneVector{} + state.ram[address];
+            m_a = laneVector{} + state.a;
+            m_d = laneVector{} + state.d;
+            m_pc = state.pc;
+            m_cycles = state.cycles;
+            m_halted = state.halted;
+        }
+
+        long long run(long long max_cycles){
+            laneVector zero = {};
+            long long cycles = 0;
+            while (cycles < max_cycles && !m_halted && m_pc < m_rom.size()){
+                uint16_t pc = m_pc;
+                ++cycles;
+                m_lane_cycles += __builtin_popcount(m_active);
+                const instruction& current = m_rom[pc];
+                if (current.is_address){
+                    m_a = zero + (int16_t)current.value;
+                    m_a_uniform = true;
+                    ++m_pc;
+                    continue;
+                }
+                uint16_t address = m_a[__builtin_ctz(m_active)] & (RAM_SIZE - 1);
+                bool uniform = m_a_uniform;     // every lane addresses the same word
+                laneVector y = m_a;
+                if (current.comp & 0x40){
+                    if (uniform)    y = m_ram[address];
+                    else            gather(y);
+                }
+                laneVector out;
+                alu(m_d, y, current.comp & 0x3f, out);
+                if (current.dest & 0x1){
+                    if (uniform)    m_ram[address] = (out & m_lanes) | (m_ram[address] & ~m_lanes);
+                    else            scatter(out);
+                }
+                if (current.dest & 0x2)     m_d = out;
+                if (current.dest & 0x4){
+                    m_a = out;
+                    m_a_uniform = same(out);
+                }
+                if (current.jump == 0){
+                    ++m_pc;
+                    continue;
+                }
+                uint32_t taken = current.jump == 7 ? m_active : m_active & jumpMask(out, current.jump);
+                if (taken == 0){
+                    ++m_pc;
+                    continue;
+                }
+                if (taken == m_active && m_a_uniform)   m_pc = m_a[__builtin_ctz(m_active)];
+                else                                    m_pc = split(taken, pc, m_cycles + cycles);
+                if (m_pc + 1 == pc && halts(m_pc))      m_halted = true;
+            }
+            m_cycles += cycles;
+            return cycles;
+        }
+
+        void setRam(int lane, int address, int16_t value){
+            m_ram[address][lane] = value;
+        }
+
+        bool active(int lane) const {       // still in step, not split off
+            return m_active & (1u << lane);
+        }
+
+        uint64_t digest(int lane) const {
+            std::vector<int16_t> ram(RAM_SIZE);
+            for (int address = 0; address < RAM_SIZE; address++)    ram[address] = m_ram[address][lane];
+            return ramDigest(ram.data());
+        }
+
+        bool halted() const {
+            return m_halted;
+        }
+
+        long long cycles() const {
+            return m_cycles;
+        }
+
+        long long laneCycles() const {      // cycles executed by the lanes while in step
+            return m_lane_cycles;
+        }
+
+        std::vector<std::pair<int, hackMachine>>& splits(){     // lane and machine of every lane split off
+            return m_splits;
+        }
+
+    private:
+        void setActive(uint32_t active){
+            m_active = active;
+            for (int lane = 0; lane < LANES; lane++)    m_lanes[lane] = (active >> lane & 1) ? -1 : 0;
+        }
+
+        bool same(const laneVector& v) const {     // equal across the active lanes
+            laneVector first = laneVector{} + v[__builtin_ctz(m_active)];
+            return (laneMask(v == first) & m_active) == m_active;
+        }
+
+        uint32_t jumpMask(const laneVector& out, int jump) const {     // bit per lane that takes the jump
+            laneVector zero = {}, taken = zero;
+            if (jump & 0x4)     taken |= out < zero;
+            if (jump & 0x2)     taken |= out == zero;
+            if (jump & 0x1)     taken |= out > zero;
+            return laneMask(taken);
+        }
+
+        void gather(laneVector& y) const {
+            for (int lane = 0; lane < LANES; lane++)    y[lane] = m_ram[m_a[lane] & (RAM_SIZE - 1)][lane];
+        }
+
+        void scatter(const laneVector& out){
+            for (int lane = 0; lane < LANES; lane++){
+                if (m_active & (1u << lane))    m_ram[m_a[lane] & (RAM_SIZE - 1)][lane] = out[lane];
+            }
+        }
+
+        bool halts(uint16_t target) const {     // the "(END) @END 0;JMP" loop
+            return m_rom[target].is_address && m_rom[target].value == target;
+        }
+
+        // the lanes going to the most common next PC stay; the PC they agree on is returned
+        uint16_t split(uint32_t taken, uint16_t pc, long long cycles){
+            uint16_t next[LANES];
+            for (int lane = 0; lane < LANES; lane++)    next[lane] = (taken >> lane & 1) ? (uint16_t)m_a[lane] : pc + 1;
+            uint16_t stay = pc + 1;
+            int best = 0;
+            for (int lane = 0; lane < LANES; lane++){
+                if (!active(lane))  continue;
+                int count = 0;
+                for (int other = 0; other < LANES; other++)     count += active(other) && next[other] == next[lane];
+                if (count > best){
+                    best = count;
+                    stay = next[lane];
+                }
+            }
+            uint32_t staying = 0;
+            for (int lane = 0; lane < LANES; lane++){
+                if (!active(lane))  continue;
+                if (next[lane] == stay){
+                    staying |= 1u << lane;
+                    continue;
+                }
+                m_splits.emplace_back(lane, hackMachine(m_rom));
+                hackMachine& machine = m_splits.back().second;
+                for (int address = 0; address < RAM_SIZE; address++)    machine.memory()[address] = m_ram[address][lane];
+                machine.setState(m_a[lane], m_d[lane], next[lane], cycles);
+                if (next[lane] + 1 == pc && halts(next[lane]))          machine.halt();
+            }
+            setActive(staying);
+            m_a_uniform = same(m_a);
+            return stay;
+        }
+
+        const std::vector<instruction>&             m_rom;
+        std::vector<laneVector>                     m_ram;      // word address -> that word in every lane
+        laneVector                                  m_a = {};
+        laneVector                                  m_d = {};
+        laneVector                                  m_lanes = {};   // all ones in the active lanes, for masked stores
+        bool                                        m_a_uniform = true;
+        uint32_t                                    m_active = 0;
+        uint16_t                                    m_pc = 0;
+        long long                                   m_cycles = 0;
+        bool                                        m_halted = false;
+        long long                                   m_lane_cycles = 0;
+        std::vector<std::pair<int, hackMachine>>    m_splits;
+};
+
+// a batch file has one instance per line, each a list of "ram:address=value" initial RAM words and
+// "key:cycle=code" keyboard events (the KBD register holds code from that cycle on), or "-" for none;
+// "#" starts a comment and lines without items are skipped
+struct batchInstance{
+    std::vector<std::pair<int, int16_t>>            ram;
+    std::vector<std::pair<long long, int16_t>>      keys;       // sorted by cycle
+};
+
+std::vector<batchInstance> loadBatch(const std::string& filename){
+    std::ifstream infile(filename);
+    if (!infile.is_open()){
+        std::cout << "cannot open " << filename << "\n";
+        std::exit(1);
+    }
+    std::vector<batchInstance> instances;
+    std::string line;
+    while (std::getline(infile, line)){
+        line = line.substr(0, line.find('#'));
+        std::stringstream items(line);
+        std::string item;
+        batchInstance instance;
+        bool empty = true;
+        while (items >> item){
+            empty = false;
+            if (item == "-")    continue;
+            size_t colon = item.find(':'), equals = item.find('=');
+            if (colon == std::string::npos || equals == std::string::npos || equals < colon){
+                std::cout << "bad batch item " << item << "\n";
+                std::exit(1);
+            }
+            std::string kind = item.substr(0, colon);
+            long long key = std::stoll(item.substr(colon + 1, equals - colon - 1));
+            int16_t value = std::stoi(item.substr(equals + 1));
+            if (kind == "ram")          instance.ram.push_back({(int)key & (RAM_SIZE - 1), value});
+            else if (kind == "key")     instance.keys.push_back({key, value});
+            else {
+                std::cout << "bad batch item " << item << "\n";
+                std::exit(1);
+            }
+        }
+        if (empty)      continue;
+        std::sort(instance.keys.begin(), instance.keys.end());
+        instances.push_back(instance);
+    }
+    return instances;
+}
+
+class batchRunner{      // many independent machines over one shared ROM, sharded across threads
+    public:
+        batchRunner(const std::vector<instruction>& rom, const std::vector<batchInstance>& instances, long long max_cycles,
+                    const snapshot* start = nullptr)     // instances fork from start rather than from reset
+            : m_rom(rom), m_instances(instances), m_max_cycles(max_cycles), m_start(start),
+              m_cycles(instances.size(), 0), m_digests(instances.size(), 0), m_halted(instances.size(), 0){}
+
+        // a worker keeps one machine and reuses its RAM for every instance it claims, so memory stays at one
+        // RAM per thread however many instances there are; per instance results land in the arrays below
+        void run(int threads, const sourceMap* map){
+            std::atomic<size_t> next{0};
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++){
+                workers.emplace_back([&](){
+                    hackMachine machine(m_rom);
+                    std::unique_ptr<nativeRuntime> runtime;
+                    if (map != nullptr){
+                        runtime.reset(new nativeRuntime(*map, false));
+                        runtime->attach(machine);
+                    }
+                    size_t first;
+                    while ((first = next.fetch_add(BATCH_CHUNK)) < m_instances.size()){
+                        size_t last = std::min(first + BATCH_CHUNK, m_instances.size());
+                        for (size_t i = first; i < last; i++)   runInstance(machine, i, runtime.get());
+                    }
+                });
+            }
+            for (std::thread& worker : workers)     worker.join();
+        }
+
+        // as run(), but a worker claims LANES instances at a time and steps them together in a lockstep group
+        void runLockstep(int threads){
+            std::atomic<size_t> next{0};
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++){
+                workers.emplace_back([&](){
+                    lockstepGroup group(m_rom);
+                    size_t first;
+                    while ((first = next.fetch_add(LANES)) < m_instances.size()){
+                        runGroup(group, first, std::min(first + LANES, m_instances.size()));
+                    }
+                });
+            }
+            for (std::thread& worker : workers)     worker.join();
+        }
+
+        void write(std::ostream& out){
+            for (size_t i = 0; i < m_instances.size(); i++){
+                out << i << " " << m_cycles[i] << " " << (m_halted[i] ? "halted" : "stopped") << " "
+                    << std::hex << std::setw(16) << std::setfill('0') << m_digests[i] << std::dec << std::setfill(' ') << "\n";
+            }
+        }
+
+        long long totalCycles() const {     // run, not counting the cycles of a start snapshot
+            long long total = 0;
+            for (long long cycles : m_cycles)   total += cycles - (m_start != nullptr ? m_start->cycles : 0);
+            return total;
+        }
+
+        long long steps() const {           // lockstep group steps, each worth LANES lanes
+            return m_steps;
+        }
+
+        long long laneCycles() const {      // cycles the lanes ran in step
+            return m_lane_cycles;
+        }
+
+    private:
+        void runInstance(hackMachine& machine, size_t index, nativeRuntime* runtime = nullptr){
+            if (m_start != nullptr)     machine.restore(*m_start);
+            else                        machine.reset();
+            if (runtime != nullptr)     runtime->start(machine);
+            for (const auto& word : m_instances[index].ram)     machine.memory()[word.first] = word.second;
+            finish(machine, index);
+        }
+
+        // runs a machine on from its current cycle, the keyboard events before that having been applied already
+        void finish(hackMachine& machine, size_t index){
+            noObserver observer;
+            for (const auto& key : m_instances[index].keys){
+                if (key.first >= m_max_cycles)      break;
+                if (key.first < machine.cycles())   continue;
+                if (key.first > machine.cycles())   machine.run(key.first - machine.cycles(), observer);
+                machine.memory()[KBD] = key.second;
+            }
+            machine.run(m_max_cycles - machine.cycles(), observer);
+            m_cycles[index] = machine.cycles();
+            m_digests[index] = machine.digest();
+            m_halted[index] = machine.halted();
+        }
+
+        void runGroup(lockstepGroup& group, size_t first, size_t last){
+            int lanes = last - first;
+            group.reset(lanes);
+            if (m_start != nullptr)     group.restore(*m_start);
+            std::vector<std::tuple<long long, int, int16_t>> keys;     // every lane's events, in cycle order
+            for (int lane = 0; lane < lanes; lane++){
+                const batchInstance& instance = m_instances[first + lane];
+                for (const auto& word : instance.ram)   group.setRam(lane, word.first, word.second);
+                for (const auto& key : instance.keys)   keys.emplace_back(key.first, lane, key.second);
+            }
+            std::sort(keys.begin(), keys.end());
+            for (const auto& key : keys){
+                long long cycle = std::get<0>(key);
+                if (cycle >= m_max_cycles)      break;
+                if (cycle > group.cycles())     group.run(cycle - group.cycles());
+                group.setRam(std::get<1>(key), KBD, std::get<2>(key));
+            }
+            group.run(m_max_cycles - group.cycles());
+            for (int lane = 0; lane < lanes; lane++){
+                if (!group.active(lane))    continue;
+                m_cycles[first + lane] = group.cycles();
+                m_digests[first + lane] = group.digest(lane);
+                m_halted[first + lane] = group.halted();
+            }
+            for (auto& split : group.splits())      finish(split.second, first + split.first);
+            m_steps += group.cycles() - (m_start != nullptr ? m_start->cycles : 0);
+            m_lane_cycles += group.laneCycles();
+        }
+
+        const std::vector<instruction>&         m_rom;
+        const std::vector<batchInstance>&       m_instances;
+        long long                               m_max_cycles;
+        const snapshot*                         m_start;
+        std::vector<long long>                  m_cycles;
+        std::vector<uint64_t>                   m_digests;
+        std::vector<uint8_t>                    m_halted;
+        std::atomic<long long>                  m_steps{0};
+        std::atomic<long long>                  m_lane_cycles{0};
+};
+
+// the screen of Project 5: RAM 16384-24575, 32 words to a row, bit 0 of a word its leftmost pixel. It is
+// kept as a PBM image; writes mark their row dirty and a capture repacks only the rows written since the last
+class framebuffer{
+    public:
+        framebuffer() : m_image(SCREEN_HEIGHT * SCREEN_WIDTH / 8, 0){
+            for (int byte = 0; byte < 256; byte++){     // PBM puts the leftmost pixel in the high bit
+                for (int bit = 0; bit < 8; bit++)   m_reversed[byte] |= ((byte >> bit) & 1) << (7 - bit);
+            }
+        }
+
+        void onJump(uint16_t, uint16_t){}
+        void onCycle(uint16_t){}
+
+        void onWrite(uint16_t address){
+            if (address < SCREEN || address >= KBD)     return;
+            int row = (address - SCREEN) / ROW_WORDS;
+            m_dirty[row / 64] |= 1ULL << (row % 64);
+        }
+
+        void touchAll(){    // the screen changed behind our back, as on a restore
+            for (uint64_t& block : m_dirty)     block = ~0ULL;
+        }
+
+        // returns the number of rows repacked, with the first and last of them
+        int capture(const std::vector<int16_t>& ram, int& first, int& last){
+            int rows = 0;
+            first = last = -1;
+            for (int block = 0; block < SCREEN_HEIGHT / 64; block++){
+                while (m_dirty[block] != 0){
+                    int row = block * 64 + __builtin_ctzll(m_dirty[block]);
+                    m_dirty[block] &= m_dirty[block] - 1;
+                    const int16_t* words = &ram[SCREEN + row * ROW_WORDS];
+                    uint8_t* bytes = &m_image[row * SCREEN_WIDTH / 8];
+                    for (int word = 0; word < ROW_WORDS; word++){
+                        bytes[2 * word] = m_reversed[words[word] & 0xff];
+                        bytes[2 * word + 1] = m_reversed[(words[word] >> 8) & 0xff];
+                    }
+                    if (first == -1)    first = row;
+                    last = row;
+                    ++rows;
+                }
+            }
+            m_rows_rendered += rows;
+            return rows;
+        }
+
+        void writePbm(std::ostream& out) const {
+            out << "P4\n" << SCREEN_WIDTH << " " << SCREEN_HEIGHT << "\n";
+            out.write((const char*)m_image.data(), m_image.size());
+        }
+
+        long long rowsRendered() const {
+            return m_rows_rendered;
+        }
+
+    private:
+        std::vector<uint8_t>    m_image;
+        uint64_t                m_dirty[SCREEN_HEIGHT / 64] = {};
+        uint8_t                 m_reversed[256] = {};
+        long long               m_rows_rendered = 0;
+};
+
+// a key script has one "cycle code" event per line, the KBD register holding code from that cycle on
+std::vector<std::pair<long long, int16_t>> loadKeys(const std::string& filename){
+    std::ifstream infile(filename);
+    if (!infile.is_open()){
+        std::cout << "cannot open " << filename << "\n";
+        std::exit(1);
+    }
+    std::vector<std::pair<long long, int16_t>> keys;
+    std::string line;
+    while (std::getline(infile, line)){
+        std::stringstream items(line.substr(0, line.find('#')));
+        long long cycle;
+        int code;
+        if (items >> cycle >> code)     keys.push_back({cycle, (int16_t)code});
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+// a snapshot file is a text header "HACKSNAP cycles a d pc halted base", base being the snapshot it is a
+// delta against or "-", then RAM XORed with the base's RAM as runs: a zero word count, a literal word count
+// and the literal words
+void writeSnapshot(const std::string& filename, const snapshot& state, const snapshot* base, const std::string& base_name){
+    std::ofstream outfile(filename, std::ios::binary);
+    outfile << "HACKSNAP " << state.cycles << " " << state.a << " " << state.d << " " << state.pc << " " << state.halted
+            << " " << (base != nullptr ? base_name : "-") << "\n";
+    auto delta = [&](int address){ return (uint16_t)(state.ram[address] ^ (base != nullptr ? base->ram[address] : 0)); };
+    std::vector<uint16_t> body;
+    for (int address = 0; address < RAM_SIZE;){
+        uint16_t zeros = 0, literals = 0;
+        while (address < RAM_SIZE && delta(address) == 0){
+            ++zeros;
+            ++address;
+        }
+        size_t count = body.size() + 1;
+        body.push_back(zeros);
+        body.push_back(0);
+        while (address < RAM_SIZE && delta(address) != 0){
+            body.push_back(delta(address++));
+            ++literals;
+        }
+        body[count] = literals;
+    }
+    outfile.write((const char*)body.data(), body.size() * sizeof(uint16_t));
+}
+
+snapshot loadSnapshot(const std::string& filename){
+    std::ifstream infile(filename, std::ios::binary);
+    if (!infile.is_open()){
+        std::cout << "cannot open " << filename << "\n";
+        std::exit(1);
+    }
+    snapshot state;
+    std::string magic, base;
+    infile >> magic >> state.cycles >> state.a >> state.d >> state.pc >> state.halted >> base;
+    infile.get();
+    if (magic != "HACKSNAP" || !infile){
+        std::cout << filename << " is not a snapshot\n";
+        std::exit(1);
+    }
+    if (base == "-")    state.ram.assign(RAM_SIZE, 0);
+    else                state.ram = loadSnapshot((fs::path(filename).parent_path() / base).string()).ram;
+    for (int address = 0; address < RAM_SIZE;){
+        uint16_t run[2];
+        if (!infile.read((char*)run, sizeof(run)) || address + run[0] + run[1] > RAM_SIZE){
+            std::cout << filename << " is truncated\n";
+            std::exit(1);
+        }
+        address += run[0];
+        for (int i = 0; i < run[1]; i++){
+            uint16_t word;
+            infile.read((char*)&word, sizeof(word));
+            state.ram[address++] ^= word;
+        }
+    }
+    return state;
+}
+
+struct sessionOptions{      // what a scripted run feeds in and writes out
+    std::vector<std::pair<long long, int16_t>>      keys;
+    long long                                       frame_cycles = FRAME_CYCLES;
+    std::string                                     frames_dir;
+    std::string                                     video_file;
+    long long                                       snapshot_cycles = SNAPSHOT_CYCLES;
+    std::string                                     snapshot_dir;
+};
+
+// runs the machine from wherever it is in steps between key events, frames and snapshots. Frames that
+// changed go to frames_dir as frame_<n>.pbm, listed in frames.txt with their cycle and dirty rows, and every
+// frame goes to the video stream. Snapshots go to snapshot_dir as snap_<cycle>.snap along with keys.txt,
+// the key events the run took, so "--restore snap --keys keys.txt" replays it from any of them
+void runSession(hackMachine& machine, long long max_cycles, const sessionOptions& options){
+    framebuffer screen;
+    bool capture = !options.frames_dir.empty() || !options.video_file.empty(), snapshots = !options.snapshot_dir.empty();
+    if (capture)    machine.onWrite([&screen](uint16_t address){ screen.onWrite(address); });
+    if (machine.cycles() > 0)   screen.touchAll();
+    std::ofstream index, video, record;
+    if (!options.frames_dir.empty()){
+        fs::create_directories(options.frames_dir);
+        index.open(options.frames_dir + "/frames.txt");
+    }
+    if (!options.video_file.empty())    video.open(options.video_file, std::ios::binary);
+    if (snapshots){
+        fs::create_directories(options.snapshot_dir);
+        record.open(options.snapshot_dir + "/keys.txt");
+    }
+    const std::vector<std::pair<long long, int16_t>>& keys = options.keys;
+    size_t key = 0;     // a restored KBD holds the events before the current cycle already
+    while (key < keys.size() && keys[key].first < machine.cycles())     ++key;
+    long long frame = machine.cycles() / options.frame_cycles, changed = 0, frames = 0;
+    long long snapshot_at = (machine.cycles() / options.snapshot_cycles + 1) * options.snapshot_cycles, taken = 0, bytes = 0;
+    snapshot previous;
+    std::string previous_name;
+    bool done = false;
+    while (true){
+        for (; key < keys.size() && keys[key].first <= machine.cycles(); key++){
+            machine.poke(KBD, keys[key].second);
+            if (snapshots)  record << keys[key].first << " " << keys[key].second << "\n";
+        }
+        if (capture && (machine.cycles() >= (frame + 1) * options.frame_cycles || done)){
+            int first, last;
+            if (screen.capture(machine.memory(), first, last) > 0){
+                ++changed;
+                if (index.is_open()){
+                    std::ofstream image(options.frames_dir + "/frame_" + std::to_string(frame) + ".pbm", std::ios::binary);
+                    screen.writePbm(image);
+                    index << frame << " " << machine.cycles() << " " << first << " " << last << "\n";
+                }
+            }
+            if (video.is_open())    screen.writePbm(video);
+            ++frame;
+            ++frames;
+        }
+        if (snapshots && machine.cycles() == snapshot_at){
+            snapshot current = machine.save();
+            std::string name = "snap_" + std::to_string(machine.cycles()) + ".snap";
+            writeSnapshot(options.snapshot_dir + "/" + name, current, taken % SNAPSHOT_KEYFRAME != 0 ? &previous : nullptr, previous_name);
+            bytes += fs::file_size(options.snapshot_dir + "/" + name);
+            previous = current;
+            previous_name = name;
+            ++taken;
+            snapshot_at += options.snapshot_cycles;
+        }
+        if (done)   break;
+        long long until = max_cycles;
+        if (capture)                    until = std::min(until, (frame + 1) * options.frame_cycles);
+        if (snapshots)                  until = std::min(until, snapshot_at);
+        if (key < keys.size())          until = std::min(until, keys[key].first);
+        machine.run(until - machine.cycles(), screen);
+        done = machine.halted() || machine.cycles() < until || machine.cycles() >= max_cycles;
+    }
+    if (capture){
+        std::cout << frames << " frames, " << changed << " changed, " << screen.rowsRendered() << " of "
+                  << frames * SCREEN_HEIGHT << " rows rendered\n";
+    }
+    if (snapshots)  std::cout << taken << " snapshots, " << bytes << " bytes\n";
+}
+
+int main(int argc, char* argv[]){
+    bool profile = false, native = false, validate = false, lockstep = false;
+    long long max_cycles = DEFAULT_MAX_CYCLES;
+    sessionOptions session;
+    std::string batch_file, key_file, restore_file;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int ram_first = 0, ram_last = -1;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--profile")                        profile = true;
+        else if (flag == "--native")                    native = true;
+        else if (flag == "--validate")                  validate = true;     // native calls are checked against the Jack OS
+        else if (flag == "--cycles" && i + 1 < argc)    max_cycles = std::stoll(argv[++i]);
+        else if (flag == "--batch" && i + 1 < argc)     batch_file = argv[++i];
+        else if (flag == "--threads" && i + 1 < argc)   threads = std::stoi(argv[++i]);
+        else if (flag == "--lockstep")                  lockstep = true;     // batch instances run LANES to a group
+        else if (flag == "--frames" && i + 1 < argc)    session.frames_dir = argv[++i];
+        else if (flag == "--video" && i + 1 < argc)     session.video_file = argv[++i];
+        else if (flag == "--frame-cycles" && i + 1 < argc)      session.frame_cycles = std::stoll(argv[++i]);
+        else if (flag == "--keys" && i + 1 < argc)      key_file = argv[++i];
+        else if (flag == "--snapshots" && i + 1 < argc)         session.snapshot_dir = argv[++i];
+        else if (flag == "--snapshot-cycles" && i + 1 < argc)   session.snapshot_cycles = std::stoll(argv[++i]);
+        else if (flag == "--restore" && i + 1 < argc)   restore_file = argv[++i];     // --cycles still counts from reset
+        else if (flag == "--ram" && i + 2 < argc){
+            ram_first = std::stoi(argv[++i]);
+            ram_last = std::stoi(argv[++i]);
+        }
+        else                                            argc = 0;
+    }
+    bool scripted = !session.frames_dir.empty() || !session.video_file.empty() || !key_file.empty() || !session.snapshot_dir.empty();
+    if (argc < 2 || (lockstep && (batch_file.empty() || native)) || (scripted && (profile || !batch_file.empty()))
+        || session.frame_cycles < 1 || session.snapshot_cycles < 1){     // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    std::string filename(argv[1]);
+    std::vector<instruction> rom = loadRom(filename);
+    std::unique_ptr<snapshot> start;
+    if (!restore_file.empty())  start.reset(new snapshot(loadSnapshot(restore_file)));
+    if (!batch_file.empty()){
+        std::vector<batchInstance> instances = loadBatch(batch_file);
+        std::unique_ptr<sourceMap> map;
+        if (native){
+            initNativeTable();
+            map.reset(new sourceMap(filename, rom.size()));
+        }
+        batchRunner batch(rom, instances, max_cycles, start.get());
+        auto start = std::chrono::steady_clock::now();
+        if (lockstep)   batch.runLockstep(threads);
+        else            batch.run(threads, map.get());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        batch.write(std::cout);
+        std::cout << "ran " << instances.size() << " instances on " << threads << " threads in " << seconds * 1000 << "ms, "
+                  << batch.totalCycles() / seconds / 1e6 << " Mcycles/s\n";
+        if (lockstep && batch.steps() > 0){
+            std::cout << "lockstep: " << 100.0 * batch.laneCycles() / (batch.steps() * LANES) << "% lane utilization, "
+                      << 100.0 * batch.laneCycles() / batch.totalCycles() << "% of cycles in step\n";
+        }
+        return 0;
+    }
+
+    hackMachine machine(rom);
+    if (start)              machine.restore(*start);
+    if (!key_file.empty())  session.keys = loadKeys(key_file);
+    if (!profile && !native && !validate){
+        noObserver observer;
+        if (scripted)   runSession(machine, max_cycles, session);
+        else            machine.run(max_cycles - machine.cycles(), observer);
+    }
+    else {      // everything else works through the source maps
+        sourceMap map(filename, rom.size());
+        initNativeTable();
+        nativeRuntime runtime(map, validate);
+        if (native || validate)     runtime.attach(machine);
+        if (profile){
+            profiler cycle_profiler(map);
+            long long cycles = machine.run(max_cycles - machine.cycles(), cycle_profiler);
+            std::string base = filename.substr(0, filename.size() - 5);
+            cycle_profiler.writeFolded(base + ".functions.folded", false);
+            cycle_profiler.writeFolded(base + ".lines.folded", true);
+            cycle_profiler.printReport(cycles);
+        }
+        else if (scripted)  runSession(machine, max_cycles, session);
+        else {
+            noObserver observer;
+            machine.run(max_cycles - machine.cycles(), observer);
+        }
+        if (native || validate)     runtime.printReport();
+        std::cout << "\n";
+    }
+
+    std::cout << (machine.halted() ? "halted after " : "stopped after ") << machine.cycles() << " cycles\n";
+    for (int address = ram_first; address <= ram_last; address++){
+        std::cout << "RAM[" << address << "] = " << machine.ram(address) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef HDL_NATIVE_H
+#define HDL_NATIVE_H
+
+// Native versions of chips that Tools/hdlc can put in place of their gates. The code it writes calls
+// them, and `hdlc Chip.hdl --verify` checks them against the gates. Pins are words in the order the chip
+// declares them: evaluate() works out the outputs within a cycle and clock() latches at the end of it.
+// evaluate() only reads the inputs hdlc lists for the chip in native_chips, the rest are 0 then.
+
+#include <cstdint>
+
+template <int ADDRESS_BITS>
+struct nativeRAM{       // in, load, address; out
+    uint16_t words[1 << ADDRESS_BITS] = {};
+
+    void evaluate(const uint16_t* in, uint16_t* out) const {
+        out[0] = words[in[2] & ((1 << ADDRESS_BITS) - 1)];
+    }
+    void clock(const uint16_t* in){
+        if (in[1])  words[in[2] & ((1 << ADDRESS_BITS) - 1)] = in[0];
+    }
+};
+
+typedef nativeRAM<3> nativeRAM8;
+typedef nativeRAM<6> nativeRAM64;
+typedef nativeRAM<9> nativeRAM512;
+typedef nativeRAM<12> nativeRAM4K;
+typedef nativeRAM<14> nativeRAM16K;
+typedef nativeRAM<13> nativeScreen;
+
+struct nativeROM32K{    // address; out
+    uint16_t words[32768] = {};
+
+    void evaluate(const uint16_t* in, uint16_t* out) const {
+        out[0] = words[in[0] & 0x7fff];
+    }
+    void clock(const uint16_t*){}
+};
+
+struct nativeKeyboard{  // out
+    uint16_t key = 0;
+
+    void evaluate(const uint16_t*, uint16_t* out) const {
+        out[0] = key;
+    }
+    void clock(const uint16_t*){}
+};
+
+struct nativeRegister{  // in, load; out
+    uint16_t value = 0;
+
+    void evaluate(const uint16_t*, uint16_t* out) const {
+        out[0] = value;
+    }
+    void clock(const uint16_t* in){
+        if (in[1])  value = in[0];
+    }
+};
+
+struct nativePC{        // in, load, inc, reset; out
+    uint16_t value = 0;
+
+    void evaluate(const uint16_t*, uint16_t* out) const {
+        out[0] = value;
+    }
+    void clock(const uint16_t* in){
+        if (in[3])          value = 0;
+        else if (in[1])     value = in[0];
+        else if (in[2])     value = value + 1;
+    }
+};
+
+struct nativeALU{       // x, y, zx, nx, zy, ny, f, no; out, zr, ng
+    void evaluate(const uint16_t* in, uint16_t* out) const {
+        uint16_t x = in[2] ? 0 : in[0], y = in[4] ? 0 : in[1];
+        if (in[3])  x = ~x;
+        if (in[5])  y = ~y;
+        uint16_t result = in[6] ? x + y : x & y;
+        if (in[7])  result = ~result;
+        out[0] = result;
+        out[1] = result == 0;
+        out[2] = result >> 15;
+    }
+    void clock(const uint16_t*){}
+};
+
+struct nativeAdd16{     // a, b; out
+    void evaluate(const uint16_t* in, uint16_t* out) const {
+        out[0] = in[0] + in[1];
+    }
+    void clock(const uint16_t*){}
+};
+
+#endif
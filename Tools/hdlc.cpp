@@ -0,0 +1,881 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <random>
+
+#include "trace.h"
+#include "hdl_native.h"
+
+// Compiles a chip of Projects 1 to 5 into C++: the chip is flattened down to Nand gates and flip-flops,
+// folded, and written out as one straight-line function that runs a clock cycle of it:
+//
+//      hdlc "Project 5/Computer.hdl" computer_gates.h [--native RAM16K,Register,PC]
+//      hdlc "Project 2/ALU.hdl" --verify [--vectors N] [--native Add16]
+//
+// Parts are looked up in the directory of the top chip, then in the directories next to it. The chips
+// named by --native (RAM16K unless it is given) run as the C++ of Tools/hdl_native.h instead of as gates,
+// and so do Screen, Keyboard and ROM32K, which have no gates. ARegister and DRegister are built from
+// Register. Buses going into a native chip or a word of flip-flops that come straight out of one are
+// copied as words instead of bit by bit. The generated code includes hdl_native.h, so it builds with
+// -I Tools; Tools/hdlcheck runs it against the emulator. --verify writes nothing, it runs the gates of
+// the top chip against its native version on random inputs.
+
+#define WORD_BITS (16)
+#define CONST_FALSE (0)     // nets 0 and 1 stand for false and true wherever they are wired
+#define CONST_TRUE (1)
+#define DEFAULT_NATIVE "RAM16K"     // 16K words of gates would be 262144 flip-flops
+#define VERIFY_VECTORS (10000LL)
+#define VERIFY_SEED (1)
+#define VERIFY_RECENT (8)           // inputs of each pin kept to be used again
+
+namespace fs = std::filesystem;
+
+struct hdlConnection{
+    std::string     pin;
+    int             pin_lo = -1, pin_hi = -1;       // -1 for the whole pin
+    std::string     value;                          // an input, output or internal pin, true or false
+    int             value_lo = -1, value_hi = -1;
+};
+
+struct hdlPart{
+    std::string                     chip;
+    std::vector<hdlConnection>      connections;
+    int                             line = 0;
+};
+
+struct hdlChip{
+    std::string                                 name;
+    std::string                                 filename;
+    std::vector<std::pair<std::string, int>>    inputs;     // pin, width
+    std::vector<std::pair<std::string, int>>    outputs;
+    std::vector<hdlPart>                        parts;
+    bool                                        builtin = false;
+};
+
+// the gates everything else is made of, in the notation of the built-in chips of the course
+const std::vector<std::string> builtin_chips = {
+    "CHIP Nand {IN a, b; OUT out; BUILTIN Nand;}",
+    "CHIP DFF {IN in; OUT out; BUILTIN DFF; CLOCKED in;}",
+};
+
+struct nativeModel{     // any chip of hdl_native.h, for --verify
+    virtual ~nativeModel(){}
+    virtual void evaluate(const uint16_t* in, uint16_t* out) = 0;
+    virtual void clock(const uint16_t* in) = 0;
+};
+
+template <typename Chip>
+struct nativeAdapter : nativeModel{
+    std::unique_ptr<Chip> m_chip = std::make_unique<Chip>();
+
+    void evaluate(const uint16_t* in, uint16_t* out) override { m_chip->evaluate(in, out); }
+    void clock(const uint16_t* in) override { m_chip->clock(in); }
+};
+
+template <typename Chip>
+nativeModel* makeNative(){
+    return new nativeAdapter<Chip>();
+}
+
+struct nativeChip{
+    std::string                 declaration;
+    std::vector<std::string>    reads;              // the inputs its outputs follow within a cycle
+    nativeModel*                (*make)();
+    bool                        always = false;     // has no gates to fall back on
+};
+
+const std::unordered_map<std::string, nativeChip> native_chips = {
+    {"RAM8",        {"CHIP RAM8 {IN in[16], load, address[3]; OUT out[16]; BUILTIN RAM8;}", {"address"}, makeNative<nativeRAM8>}},
+    {"RAM64",       {"CHIP RAM64 {IN in[16], load, address[6]; OUT out[16]; BUILTIN RAM64;}", {"address"}, makeNative<nativeRAM64>}},
+    {"RAM512",      {"CHIP RAM512 {IN in[16], load, address[9]; OUT out[16]; BUILTIN RAM512;}", {"address"}, makeNative<nativeRAM512>}},
+    {"RAM4K",       {"CHIP RAM4K {IN in[16], load, address[12]; OUT out[16]; BUILTIN RAM4K;}", {"address"}, makeNative<nativeRAM4K>}},
+    {"RAM16K",      {"CHIP RAM16K {IN in[16], load, address[14]; OUT out[16]; BUILTIN RAM16K;}", {"address"}, makeNative<nativeRAM16K>}},
+    {"Screen",      {"CHIP Screen {IN in[16], load, address[13]; OUT out[16]; BUILTIN Screen;}", {"address"}, makeNative<nativeScreen>, true}},
+    {"Keyboard",    {"CHIP Keyboard {OUT out[16]; BUILTIN Keyboard;}", {}, makeNative<nativeKeyboard>, true}},
+    {"ROM32K",      {"CHIP ROM32K {IN address[15]; OUT out[16]; BUILTIN ROM32K;}", {"address"}, makeNative<nativeROM32K>, true}},
+    {"Register",    {"CHIP Register {IN in[16], load; OUT out[16]; BUILTIN Register;}", {}, makeNative<nativeRegister>}},
+    {"PC",          {"CHIP PC {IN in[16], load, inc, reset; OUT out[16]; BUILTIN PC;}", {}, makeNative<nativePC>}},
+    {"ALU",         {"CHIP ALU {IN x[16], y[16], zx, nx, zy, ny, f, no; OUT out[16], zr, ng; BUILTIN ALU;}",
+                     {"x", "y", "zx", "nx", "zy", "ny", "f", "no"}, makeNative<nativeALU>}},
+    {"Add16",       {"CHIP Add16 {IN a[16], b[16]; OUT out[16]; BUILTIN Add16;}", {"a", "b"}, makeNative<nativeAdd16>}},
+};
+
+const std::unordered_map<std::string, std::string> chip_aliases = {
+    {"ARegister", "Register"},
+    {"DRegister", "Register"},
+};
+
+class hdlParser{
+    public:
+        hdlParser(const std::string& filename, const std::string& source) : m_filename(filename), m_source(source){}
+
+        hdlChip parse(){
+            hdlChip chip;
+            chip.filename = m_filename;
+            expect("CHIP");
+            chip.name = next();
+            expect("{");
+            while (peek() == "IN" || peek() == "OUT"){
+                std::string section = next();
+                parsePins(section == "IN" ? chip.inputs : chip.outputs);
+            }
+            if (peek() == "BUILTIN"){
+                next();
+                next();
+                expect(";");
+                chip.builtin = true;
+                while (peek() == "CLOCKED"){        // every built-in clocked chip here latches at the end of a cycle
+                    while (next() != ";"){}
+                }
+            }
+            else{
+                expect("PARTS");
+                expect(":");
+                while (peek() != "}")   chip.parts.push_back(parsePart());
+            }
+            expect("}");
+            return chip;
+        }
+
+    private:
+        std::string         m_filename;
+        std::string         m_source;
+        size_t              m_pos = 0;
+        int                 m_line = 1;
+        std::string         m_peeked;
+        bool                m_has_peeked = false;
+
+        void fail(const std::string& message){
+            std::cout << m_filename << ":" << m_line << ": " << message << "\n";
+            std::exit(1);
+        }
+
+        void skipSpace(){
+            while (m_pos < m_source.size()){
+                char c = m_source[m_pos];
+                if (c == '\n')      ++m_line;
+                if (std::isspace((unsigned char)c))     ++m_pos;
+                else if (m_source.compare(m_pos, 2, "//") == 0){
+                    while (m_pos < m_source.size() && m_source[m_pos] != '\n')   ++m_pos;
+                }
+                else if (m_source.compare(m_pos, 2, "/*") == 0){
+                    size_t end = m_source.find("*/", m_pos + 2);
+                    if (end == std::string::npos)   fail("unterminated comment");
+                    m_line += std::count(m_source.begin() + m_pos, m_source.begin() + end, '\n');
+                    m_pos = end + 2;
+                }
+                else    break;
+            }
+        }
+
+        std::string next(){
+            if (m_has_peeked){
+                m_has_peeked = false;
+                return m_peeked;
+            }
+            skipSpace();
+            if (m_pos >= m_source.size())   fail("unexpected end of file");
+            size_t start = m_pos;
+            if (std::isalnum((unsigned char)m_source[m_pos]) || m_source[m_pos] == '_'){
+                while (m_pos < m_source.size() && (std::isalnum((unsigned char)m_source[m_pos]) || m_source[m_pos] == '_'))     ++m_pos;
+            }
+            else if (m_source.compare(m_pos, 2, "..") == 0)     m_pos += 2;
+            else    ++m_pos;
+            return m_source.substr(start, m_pos - start);
+        }
+
+        const std::string& peek(){
+            if (!m_has_peeked){
+                m_peeked = next();
+                m_has_peeked = true;
+            }
+            return m_peeked;
+        }
+
+        void expect(const std::string& token){
+            std::string found = next();
+            if (found != token)     fail("expected " + token + " but found " + found);
+        }
+
+        int number(){
+            std::string token = next();
+            if (token.empty() || !std::all_of(token.begin(), token.end(), ::isdigit))   fail("expected a number but found " + token);
+            return std::stoi(token);
+        }
+
+        void parsePins(std::vector<std::pair<std::string, int>>& pins){
+            while (true){
+                std::string name = next();
+                int width = 1;
+                if (peek() == "["){
+                    next();
+                    width = number();
+                    expect("]");
+                }
+                if (width < 1 || width > WORD_BITS)     fail("pin " + name + " is wider than a word");
+                pins.push_back({name, width});
+                std::string separator = next();
+                if (separator == ";")   return;
+                if (separator != ",")   fail("expected , or ; but found " + separator);
+            }
+        }
+
+        void parseSlice(int& lo, int& hi){
+            if (peek() != "[")  return;
+            next();
+            lo = hi = number();
+            if (peek() == ".."){
+                next();
+                hi = number();
+            }
+            expect("]");
+            if (hi < lo)    fail("empty slice");
+        }
+
+        hdlPart parsePart(){
+            hdlPart part;
+            part.line = m_line;
+            part.chip = next();
+            expect("(");
+            while (true){
+                hdlConnection connection;
+                connection.pin = next();
+                parseSlice(connection.pin_lo, connection.pin_hi);
+                expect("=");
+                connection.value = next();
+                parseSlice(connection.value_lo, connection.value_hi);
+                part.connections.push_back(connection);
+                std::string separator = next();
+                if (separator == ")")   break;
+                if (separator != ",")   fail("expected , or ) but found " + separator);
+            }
+            expect(";");
+            return part;
+        }
+};
+
+enum netKind{
+    UNDRIVEN,
+    INPUT,          // a bit of an input of the top chip
+    FLIPFLOP,       // the output of a DFF, as latched at the last clock edge
+    NATIVE_BIT,     // a bit of an output of a native chip
+    NAND,
+    NOT,            // only made by folding, for a Nand with both inputs alike or one of them true
+};
+
+struct netDriver{
+    netKind     kind = UNDRIVEN;
+    int         a = -1, b = -1;     // the input nets of a gate
+    int         index = 0;          // the input pin, flip-flop or native chip
+    int         pin = 0;            // of the native chip
+    int         bit = 0;
+};
+
+struct nativePart{
+    std::string                         chip;
+    std::string                         name;       // of its member in the generated code: ram16k0, register1 ...
+    std::vector<std::vector<int>>       inputs;     // per pin, in the order the chip declares them
+    std::vector<std::vector<int>>       outputs;
+    std::vector<bool>                   reads;      // per input, whether evaluate() looks at it
+};
+
+struct topPin{
+    std::string         name;
+    std::vector<int>    nets;
+};
+
+class hdlCompiler{
+    public:
+        hdlCompiler(const std::string& top_filename, const std::vector<std::string>& native){
+            fs::path top(top_filename);
+            m_search.push_back(top.parent_path().empty() ? fs::path(".") : top.parent_path());
+            std::vector<fs::path> siblings;
+            fs::path parent = fs::absolute(m_search[0]).parent_path();
+            for (const auto& entry : fs::directory_iterator(parent)){
+                if (entry.is_directory() && !fs::equivalent(entry.path(), m_search[0]))    siblings.push_back(entry.path());
+            }
+            std::sort(siblings.begin(), siblings.end());
+            m_search.insert(m_search.end(), siblings.begin(), siblings.end());
+            for (const std::string& source : builtin_chips){
+                hdlChip chip = hdlParser("<builtin>", source).parse();
+                m_chips[chip.name] = chip;
+            }
+            for (const auto& entry : native_chips){
+                if (entry.second.always)    m_natives[entry.first] = hdlParser("<native>", entry.second.declaration).parse();
+            }
+            for (const std::string& name : native){
+                auto entry = native_chips.find(name);
+                if (entry == native_chips.end())    fail("no native " + name + " in hdl_native.h");
+                m_natives[name] = hdlParser("<native>", entry->second.declaration).parse();
+            }
+            m_top = &loadFile(top_filename);
+        }
+
+        void flatten(){
+            TRACE_SCOPE("hdlCompiler::flatten");
+            newNet();       // CONST_FALSE
+            newNet();       // CONST_TRUE
+            std::unordered_map<std::string, std::vector<int>> pins;
+            for (const auto& pin : m_top->inputs){
+                pins[pin.first] = newNets(pin.second);
+                m_inputs.push_back({pin.first, pins[pin.first]});
+            }
+            for (const auto& pin : m_top->outputs){
+                pins[pin.first] = newNets(pin.second);
+                m_outputs.push_back({pin.first, pins[pin.first]});
+            }
+            std::vector<std::string> stack;
+            instantiate(*m_top, pins, stack);
+
+            m_drivers.assign(m_parent.size(), netDriver());
+            for (size_t i = 0; i < m_inputs.size(); i++){
+                for (size_t bit = 0; bit < m_inputs[i].nets.size(); bit++)     drive(m_inputs[i].nets[bit], {INPUT, -1, -1, (int)i, 0, (int)bit});
+            }
+            for (size_t i = 0; i < m_flipflops.size(); i++)     drive(m_flipflops[i].second, {FLIPFLOP, -1, -1, (int)i, 0, 0});
+            for (size_t p = 0; p < m_parts.size(); p++){
+                for (size_t pin = 0; pin < m_parts[p].outputs.size(); pin++){
+                    for (size_t bit = 0; bit < m_parts[p].outputs[pin].size(); bit++)  drive(m_parts[p].outputs[pin][bit], {NATIVE_BIT, -1, -1, (int)p, (int)pin, (int)bit});
+                }
+            }
+            for (const auto& gate : m_nands)    drive(gate[2], {NAND, gate[0], gate[1], 0, 0, 0});
+        }
+
+        // folds constants and double negations while it orders the gates that something depends on: the
+        // next state of every flip-flop, the inputs of the native chips and the outputs of the top chip
+        void schedule(){
+            TRACE_SCOPE("hdlCompiler::schedule");
+            m_value.assign(m_parent.size(), -1);
+            m_state.assign(m_parent.size(), 0);
+            m_evaluated.assign(m_parts.size(), false);
+            for (auto& flipflop : m_flipflops)      flipflop.first = visit(flipflop.first);
+            for (size_t p = 0; p < m_parts.size(); p++){
+                evaluateNative(p);      // even if nothing reads it, whoever drives the chip may want its inputs
+                for (auto& pin : m_parts[p].inputs){
+                    for (int& net : pin)    net = visit(net);
+                }
+            }
+            for (topPin& pin : m_outputs){
+                for (int& net : pin.nets)   net = visit(net);
+            }
+            prune();
+        }
+
+        void write(const std::string& filename){
+            TRACE_SCOPE("hdlCompiler::write");
+            std::ofstream out(filename);
+            if (!out){
+                std::cout << "Could not open " << filename << "\n";
+                std::exit(1);
+            }
+            std::string type = m_top->name + "Gates";
+            out << "// Generated by hdlc from " << fs::path(m_top->filename).filename().string() << ": " << gates()
+                << " gates, " << m_flipflops.size() << " flip-flops and " << m_parts.size() << " native chips. Do not edit.\n";
+            out << "#include <cstdint>\n";
+            out << "#include \"hdl_native.h\"\n\n";
+            out << "struct " << type << "{\n";
+            for (const topPin& pin : m_inputs)      out << "    " << pinType(pin) << " " << pin.name << " = 0;\n";
+            for (const topPin& pin : m_outputs)     out << "    " << pinType(pin) << " " << pin.name << " = 0;\n";
+            out << "    uint16_t dff[" << std::max<size_t>(1, (m_flipflops.size() + WORD_BITS - 1) / WORD_BITS) << "] = {};\n";
+            for (const nativePart& part : m_parts){
+                out << "    native" << part.chip << " " << part.name << ";\n";
+                out << "    uint16_t " << part.name << "_in[" << std::max<size_t>(1, part.inputs.size()) << "] = {};       // as of the last clock edge\n";
+            }
+            out << "\n    void cycle(){\n";
+            for (int net : m_order){
+                if (net < 0){
+                    int p = -1 - net;
+                    const nativePart& part = m_parts[p];
+                    out << "        const uint16_t e" << p << "[] = {";
+                    for (size_t pin = 0; pin < part.inputs.size(); pin++)   out << (pin ? ", " : "") << (part.reads[pin] ? word(part.inputs[pin]) : "0");
+                    out << (part.inputs.empty() ? "0};\n" : "};\n");
+                    out << "        uint16_t p" << p << "[" << part.outputs.size() << "];\n";
+                    out << "        " << part.name << ".evaluate(e" << p << ", p" << p << ");\n";
+                    continue;
+                }
+                const netDriver& driver = m_drivers[net];
+                out << "        const bool n" << net << " = ";
+                if (driver.kind == INPUT){
+                    const topPin& pin = m_inputs[driver.index];
+                    if (pin.nets.size() == 1)   out << pin.name << ";\n";
+                    else                        out << "(" << pin.name << " >> " << driver.bit << ") & 1;\n";
+                }
+                else if (driver.kind == FLIPFLOP)   out << "(dff[" << driver.index / WORD_BITS << "] >> " << driver.index % WORD_BITS << ") & 1;\n";
+                else if (driver.kind == NATIVE_BIT) out << "(p" << driver.index << "[" << driver.pin << "] >> " << driver.bit << ") & 1;\n";
+                else if (driver.kind == NAND)       out << "!(n" << driver.a << " & n" << driver.b << ");\n";
+                else                                out << "!n" << driver.a << ";\n";
+            }
+
+            // everything the clock edge stores is worked out before any of it is stored
+            std::vector<std::vector<int>> next = flipflopWords();
+            for (size_t w = 0; w < next.size(); w++)    out << "        const uint16_t d" << w << " = " << word(next[w]) << ";\n";
+            for (const nativePart& part : m_parts){
+                for (size_t pin = 0; pin < part.inputs.size(); pin++)   out << "        " << part.name << "_in[" << pin << "] = " << word(part.inputs[pin]) << ";\n";
+            }
+            for (const topPin& pin : m_outputs){
+                out << "        " << pin.name << " = " << (pin.nets.size() == 1 ? ref(pin.nets[0]) : word(pin.nets)) << ";\n";
+            }
+            for (size_t w = 0; w * WORD_BITS < m_flipflops.size(); w++)    out << "        dff[" << w << "] = d" << w << ";\n";
+            for (const nativePart& part : m_parts)  out << "        " << part.name << ".clock(" << part.name << "_in);\n";
+            out << "    }\n};\n\n";
+            out << "typedef " << type << " hdlModel;\n";
+        }
+
+        // runs the gates of the top chip against its native version on random inputs, half of them fresh
+        // and half taken again from the last few, so that memories get read back where they were written
+        bool verify(long long vectors){
+            TRACE_SCOPE("hdlCompiler::verify");
+            auto entry = native_chips.find(m_top->name);
+            if (entry == native_chips.end())    fail("no native " + m_top->name + " in hdl_native.h to verify");
+            std::unique_ptr<nativeModel> reference(entry->second.make());
+            std::vector<std::unique_ptr<nativeModel>> models;
+            std::vector<std::vector<uint16_t>> evaluated(m_parts.size()), clocked(m_parts.size()), outputs(m_parts.size());
+            for (size_t p = 0; p < m_parts.size(); p++){
+                models.emplace_back(native_chips.at(m_parts[p].chip).make());
+                evaluated[p].assign(std::max<size_t>(1, m_parts[p].inputs.size()), 0);
+                clocked[p].assign(std::max<size_t>(1, m_parts[p].inputs.size()), 0);
+                outputs[p].assign(m_parts[p].outputs.size(), 0);
+            }
+            std::vector<char> value(m_drivers.size(), 0), state(m_flipflops.size(), 0);
+            value[CONST_TRUE] = 1;
+            std::vector<uint16_t> in(std::max<size_t>(1, m_inputs.size())), expected(m_outputs.size());
+            auto wordOf = [&](const std::vector<int>& nets){      // as word() puts it: prune() dropped the bits of a bus taken whole
+                uint16_t word = 0;
+                if (whole(nets)){
+                    const netDriver& first = m_drivers[nets[0]];
+                    if (first.kind == FLIPFLOP){
+                        for (size_t bit = 0; bit < nets.size(); bit++)  word |= state[first.index + bit] << bit;
+                        return word;
+                    }
+                    word = first.kind == NATIVE_BIT ? outputs[first.index][first.pin] : in[first.index];
+                    return nets.size() == WORD_BITS ? word : (uint16_t)(word & ((1 << nets.size()) - 1));
+                }
+                for (size_t bit = 0; bit < nets.size(); bit++)  word |= value[nets[bit]] << bit;
+                return word;
+            };
+
+            std::mt19937 random(VERIFY_SEED);
+            std::vector<std::vector<int>> next_state = flipflopWords();
+            std::vector<std::vector<uint16_t>> recent(m_inputs.size());
+            for (long long vector = 0; vector < vectors; vector++){
+                for (size_t i = 0; i < m_inputs.size(); i++){
+                    std::vector<uint16_t>& pool = recent[i];
+                    in[i] = (random() & 1) && !pool.empty() ? pool[random() % pool.size()] : randomInput(random, m_inputs[i].nets.size());
+                    if (pool.size() < VERIFY_RECENT)    pool.push_back(in[i]);
+                    else                                pool[vector % VERIFY_RECENT] = in[i];
+                }
+                for (int net : m_order){
+                    if (net < 0){
+                        int p = -1 - net;
+                        for (size_t pin = 0; pin < m_parts[p].inputs.size(); pin++)    evaluated[p][pin] = m_parts[p].reads[pin] ? wordOf(m_parts[p].inputs[pin]) : 0;
+                        models[p]->evaluate(evaluated[p].data(), outputs[p].data());
+                        continue;
+                    }
+                    const netDriver& driver = m_drivers[net];
+                    if (driver.kind == INPUT)           value[net] = (in[driver.index] >> driver.bit) & 1;
+                    else if (driver.kind == FLIPFLOP)   value[net] = state[driver.index];
+                    else if (driver.kind == NATIVE_BIT) value[net] = (outputs[driver.index][driver.pin] >> driver.bit) & 1;
+                    else if (driver.kind == NAND)       value[net] = !(value[driver.a] & value[driver.b]);
+                    else                                value[net] = !value[driver.a];
+                }
+                reference->evaluate(in.data(), expected.data());
+                for (size_t o = 0; o < m_outputs.size(); o++){
+                    uint16_t gates = wordOf(m_outputs[o].nets);
+                    if (gates == expected[o])   continue;
+                    std::cout << "vector " << vector << ": " << m_outputs[o].name << " is " << gates << " from the gates and "
+                              << expected[o] << " from native" << m_top->name << ", with";
+                    for (size_t i = 0; i < m_inputs.size(); i++)    std::cout << " " << m_inputs[i].name << "=" << in[i];
+                    std::cout << "\n";
+                    return false;
+                }
+
+                std::vector<uint16_t> next(next_state.size());
+                for (size_t w = 0; w < next_state.size(); w++)      next[w] = wordOf(next_state[w]);
+                for (size_t i = 0; i < m_flipflops.size(); i++)     state[i] = (next[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+                for (size_t p = 0; p < m_parts.size(); p++){
+                    for (size_t pin = 0; pin < m_parts[p].inputs.size(); pin++)    clocked[p][pin] = wordOf(m_parts[p].inputs[pin]);
+                    models[p]->clock(clocked[p].data());
+                }
+                reference->clock(in.data());
+            }
+            std::cout << m_top->name << ": " << vectors << " random vectors agree with native" << m_top->name << "\n";
+            return true;
+        }
+
+        // a control bit is set a quarter of the time, so that counters get to count; a quarter of the
+        // words are small or at the edges of the signed range
+        static uint16_t randomInput(std::mt19937& random, size_t width){
+            uint16_t mask = (1 << width) - 1;
+            if (width == 1)     return random() % 4 == 0;
+            if (random() % 4)   return random() & mask;
+            const uint16_t edges[] = {0, 1, 0x7fff, 0x8000, 0xffff, (uint16_t)(random() % 16)};
+            return edges[random() % 6] & mask;
+        }
+
+        void printSummary(){
+            std::cout << m_top->name << ": " << m_nands.size() << " nands flattened, " << gates() << " gates after folding, "
+                      << m_flipflops.size() << " flip-flops, " << m_parts.size() << " native chips";
+            if (m_undriven)     std::cout << ", " << m_undriven << " undriven nets read as false";
+            std::cout << "\n";
+        }
+
+    private:
+        std::vector<fs::path>                               m_search;
+        std::unordered_map<std::string, hdlChip>            m_chips;
+        std::unordered_map<std::string, hdlChip>            m_natives;      // the chips run as hdl_native.h
+        const hdlChip*                                      m_top = nullptr;
+        std::vector<int>                                    m_parent;       // union-find over nets wired together
+        std::vector<std::array<int, 3>>                     m_nands;        // a, b, out
+        std::vector<std::pair<int, int>>                    m_flipflops;    // in, out
+        std::vector<nativePart>                             m_parts;
+        std::unordered_map<std::string, int>                m_part_count;
+        std::vector<topPin>                                 m_inputs;
+        std::vector<topPin>                                 m_outputs;
+        std::vector<netDriver>                              m_drivers;
+        std::vector<int>                                    m_value;        // the net a net folds to
+        std::vector<char>                                   m_state;        // 1 while visited, 2 once done
+        std::unordered_map<int, int>                        m_negations;    // net, the NOT made of it
+        std::vector<bool>                                   m_evaluated;
+        std::vector<int>                                    m_order;        // nets, and -1 - p for evaluating native chip p
+        int                                                 m_undriven = 0;
+
+        static void fail(const std::string& message){
+            std::cout << message << "\n";
+            std::exit(1);
+        }
+
+        hdlChip& loadFile(const std::string& filename){
+            std::ifstream infile(filename);
+            if (!infile)    fail("Could not open " + filename);
+            std::stringstream source;
+            source << infile.rdbuf();
+            hdlChip chip = hdlParser(fs::path(filename).filename().string(), source.str()).parse();
+            std::string name = chip.name;
+            if (chip.builtin && m_chips.count(name))    return m_chips[name];
+            if (chip.builtin)   fail(filename + ": " + name + " is built in, name it with --native");
+            return m_chips[name] = std::move(chip);
+        }
+
+        const hdlChip& chip(const std::string& name){
+            auto alias = chip_aliases.find(name);
+            if (alias != chip_aliases.end())    return chip(alias->second);
+            auto native = m_natives.find(name);
+            if (native != m_natives.end())      return native->second;
+            auto found = m_chips.find(name);
+            if (found != m_chips.end())     return found->second;
+            for (const fs::path& directory : m_search){
+                fs::path candidate = directory / (name + ".hdl");
+                if (fs::exists(candidate))  return loadFile(candidate.string());
+            }
+            fail("no chip " + name + " next to " + m_top->filename);
+            return *m_top;
+        }
+
+        int newNet(){
+            m_parent.push_back(m_parent.size());
+            return m_parent.size() - 1;
+        }
+
+        std::vector<int> newNets(int width){
+            std::vector<int> nets(width);
+            for (int& net : nets)   net = newNet();
+            return nets;
+        }
+
+        int find(int net){
+            while (m_parent[net] != net){
+                m_parent[net] = m_parent[m_parent[net]];
+                net = m_parent[net];
+            }
+            return net;
+        }
+
+        void unite(int a, int b){       // a constant stays the root of whatever it is wired to
+            a = find(a);
+            b = find(b);
+            if (a == b)     return;
+            if (b <= CONST_TRUE)    std::swap(a, b);
+            if (b <= CONST_TRUE)    fail("true is wired to false");
+            m_parent[b] = a;
+        }
+
+        void drive(int net, const netDriver& driver){
+            net = find(net);
+            if (net <= CONST_TRUE || m_drivers[net].kind != UNDRIVEN)   fail("a net has more than one driver");
+            m_drivers[net] = driver;
+        }
+
+        static int pinWidth(const std::vector<std::pair<std::string, int>>& pins, const std::string& name){
+            for (const auto& pin : pins){
+                if (pin.first == name)  return pin.second;
+            }
+            return 0;
+        }
+
+        void instantiate(const hdlChip& chip_def, std::unordered_map<std::string, std::vector<int>>& pins, std::vector<std::string>& stack){
+            if (std::find(stack.begin(), stack.end(), chip_def.name) != stack.end())    fail(chip_def.name + " is built from itself");
+            stack.push_back(chip_def.name);
+            for (const hdlPart& part : chip_def.parts){
+                const hdlChip& part_def = chip(part.chip);
+                std::string where = chip_def.filename + ":" + std::to_string(part.line) + ": ";
+                std::unordered_map<std::string, std::vector<int>> part_pins;
+                std::unordered_map<std::string, std::vector<bool>> wired;
+                for (const auto& pin : part_def.inputs){
+                    part_pins[pin.first] = newNets(pin.second);
+                    wired[pin.first].assign(pin.second, false);
+                }
+                for (const auto& pin : part_def.outputs)    part_pins[pin.first] = newNets(pin.second);
+
+                for (const hdlConnection& connection : part.connections){
+                    auto pin = part_pins.find(connection.pin);
+                    if (pin == part_pins.end())     fail(where + part.chip + " has no pin " + connection.pin);
+                    int lo = connection.pin_lo < 0 ? 0 : connection.pin_lo;
+                    int hi = connection.pin_lo < 0 ? (int)pin->second.size() - 1 : connection.pin_hi;
+                    if (hi >= (int)pin->second.size())  fail(where + connection.pin + " has no bit " + std::to_string(hi));
+                    int width = hi - lo + 1;
+                    bool is_input = pinWidth(part_def.inputs, connection.pin) > 0;
+
+                    std::vector<int> value;
+                    if (connection.value == "true" || connection.value == "false"){
+                        if (!is_input)  fail(where + "an output of " + part.chip + " is wired to a constant");
+                        value.assign(width, connection.value == "true" ? CONST_TRUE : CONST_FALSE);
+                    }
+                    else{
+                        auto found = pins.find(connection.value);
+                        if (found == pins.end()){       // an internal pin takes its width from where it is first used
+                            int internal = connection.value_lo < 0 ? width : connection.value_hi + 1;
+                            found = pins.insert({connection.value, newNets(internal)}).first;
+                        }
+                        int vlo = connection.value_lo < 0 ? 0 : connection.value_lo;
+                        int vhi = connection.value_lo < 0 ? (int)found->second.size() - 1 : connection.value_hi;
+                        if (vhi >= (int)found->second.size())   fail(where + connection.value + " has no bit " + std::to_string(vhi));
+                        if (vhi - vlo + 1 != width)     fail(where + connection.pin + " and " + connection.value + " differ in width");
+                        value.assign(found->second.begin() + vlo, found->second.begin() + vhi + 1);
+                    }
+                    for (int bit = 0; bit < width; bit++){
+                        unite(pin->second[lo + bit], value[bit]);
+                        if (is_input)   wired[connection.pin][lo + bit] = true;
+                    }
+                }
+                for (const auto& pin : wired){      // inputs left unconnected read false
+                    for (size_t bit = 0; bit < pin.second.size(); bit++){
+                        if (!pin.second[bit])   unite(part_pins[pin.first][bit], CONST_FALSE);
+                    }
+                }
+
+                if (part_def.builtin)   addPrimitive(part_def, part_pins);
+                else                    instantiate(part_def, part_pins, stack);
+            }
+            stack.pop_back();
+        }
+
+        void addPrimitive(const hdlChip& chip_def, std::unordered_map<std::string, std::vector<int>>& pins){
+            if (chip_def.name == "Nand"){
+                m_nands.push_back({pins["a"][0], pins["b"][0], pins["out"][0]});
+                return;
+            }
+            if (chip_def.name == "DFF"){
+                m_flipflops.push_back({pins["in"][0], pins["out"][0]});
+                return;
+            }
+            nativePart part;
+            part.chip = chip_def.name;
+            std::string lower = chip_def.name;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            part.name = lower + std::to_string(m_part_count[chip_def.name]++);
+            const std::vector<std::string>& reads = native_chips.at(chip_def.name).reads;
+            for (const auto& pin : chip_def.inputs){
+                part.inputs.push_back(pins[pin.first]);
+                part.reads.push_back(std::find(reads.begin(), reads.end(), pin.first) != reads.end());
+            }
+            for (const auto& pin : chip_def.outputs)    part.outputs.push_back(pins[pin.first]);
+            m_parts.push_back(part);
+        }
+
+        int negation(int net){
+            const netDriver& driver = m_drivers[net];
+            if (driver.kind == NOT)     return driver.a;
+            auto found = m_negations.find(net);
+            if (found != m_negations.end())     return found->second;
+            int result = newNet();
+            m_drivers.push_back({NOT, net, -1, 0, 0, 0});
+            m_state.push_back(2);
+            m_value.push_back(result);
+            m_order.push_back(result);
+            m_negations[net] = result;
+            return result;
+        }
+
+        void evaluateNative(int p){
+            if (m_evaluated[p])     return;
+            m_evaluated[p] = true;
+            for (size_t pin = 0; pin < m_parts[p].inputs.size(); pin++){
+                if (!m_parts[p].reads[pin])     continue;
+                for (int& net : m_parts[p].inputs[pin])     net = visit(net);
+            }
+            m_order.push_back(-1 - p);
+        }
+
+        int visit(int net){
+            net = find(net);
+            if (net <= CONST_TRUE)      return net;
+            if (m_state[net] == 2)      return m_value[net];
+            if (m_state[net] == 1)      fail("a loop of gates with no flip-flop in it");
+            m_state[net] = 1;
+            netDriver driver = m_drivers[net];     // a copy, folding below adds nets
+            int value = net;
+            if (driver.kind == UNDRIVEN){
+                ++m_undriven;
+                value = CONST_FALSE;
+            }
+            else if (driver.kind == NATIVE_BIT){
+                evaluateNative(driver.index);
+                m_order.push_back(net);
+            }
+            else if (driver.kind == NAND){
+                int a = visit(driver.a), b = visit(driver.b);
+                if (a == CONST_FALSE || b == CONST_FALSE)   value = CONST_TRUE;
+                else if (a == CONST_TRUE && b == CONST_TRUE)    value = CONST_FALSE;
+                else if (a == CONST_TRUE)   value = negation(b);
+                else if (b == CONST_TRUE || a == b)     value = negation(a);
+                else{
+                    m_drivers[net].a = a;
+                    m_drivers[net].b = b;
+                    m_order.push_back(net);
+                }
+            }
+            else    m_order.push_back(net);
+            m_state[net] = 2;
+            m_value[net] = value;
+            return value;
+        }
+
+        // drops the negations that folding made and then folded away again, and the bits of buses that
+        // are only ever taken whole
+        void prune(){
+            std::vector<bool> live(m_drivers.size(), false);
+            std::vector<int> pending;
+            auto sink = [&](const std::vector<int>& nets){      // a bus taken whole needs none of its bits
+                if (!whole(nets))   pending.insert(pending.end(), nets.begin(), nets.end());
+            };
+            for (const auto& next : flipflopWords())    sink(next);
+            for (const nativePart& part : m_parts){
+                for (const auto& pin : part.inputs)     sink(pin);
+            }
+            for (const topPin& pin : m_outputs){
+                if (pin.nets.size() == 1)   pending.push_back(pin.nets[0]);     // written out as a bit
+                else                        sink(pin.nets);
+            }
+            while (!pending.empty()){
+                int net = pending.back();
+                pending.pop_back();
+                if (net <= CONST_TRUE || live[net])     continue;
+                live[net] = true;
+                const netDriver& driver = m_drivers[net];
+                if (driver.kind == NAND || driver.kind == NOT)  pending.push_back(driver.a);
+                if (driver.kind == NAND)                        pending.push_back(driver.b);
+            }
+            m_order.erase(std::remove_if(m_order.begin(), m_order.end(), [&](int net){ return net >= 0 && !live[net]; }), m_order.end());
+        }
+
+        std::string ref(int net){
+            if (net == CONST_FALSE)     return "false";
+            if (net == CONST_TRUE)      return "true";
+            return "n" + std::to_string(net);
+        }
+
+        // whether a bus is an output of a native chip, a word of flip-flops or an input, in bit order
+        bool whole(const std::vector<int>& nets){
+            const netDriver& first = m_drivers[nets[0]];
+            if (nets[0] <= CONST_TRUE || (first.kind != NATIVE_BIT && first.kind != FLIPFLOP && first.kind != INPUT))   return false;
+            int base = first.kind == FLIPFLOP ? first.index : first.bit;
+            if (base % WORD_BITS != 0)  return false;
+            for (size_t bit = 0; bit < nets.size(); bit++){
+                const netDriver& driver = m_drivers[nets[bit]];
+                bool same = nets[bit] > CONST_TRUE && driver.kind == first.kind && (first.kind == FLIPFLOP ? driver.index == base + (int)bit
+                            : driver.index == first.index && driver.pin == first.pin && driver.bit == (int)bit);
+                if (!same)  return false;
+            }
+            return true;
+        }
+
+        std::vector<std::vector<int>> flipflopWords(){      // the next state of the flip-flops, 16 to a word
+            std::vector<std::vector<int>> words((m_flipflops.size() + WORD_BITS - 1) / WORD_BITS);
+            for (size_t i = 0; i < m_flipflops.size(); i++)     words[i / WORD_BITS].push_back(m_flipflops[i].first);
+            return words;
+        }
+
+        // a bus as a word: taken whole where it can be, put together bit by bit otherwise
+        std::string word(const std::vector<int>& nets){
+            if (whole(nets)){
+                const netDriver& first = m_drivers[nets[0]];
+                std::string source = first.kind == NATIVE_BIT ? "p" + std::to_string(first.index) + "[" + std::to_string(first.pin) + "]"
+                                   : first.kind == FLIPFLOP ? "dff[" + std::to_string(first.index / WORD_BITS) + "]" : m_inputs[first.index].name;
+                if (nets.size() == WORD_BITS)   return source;
+                return "(uint16_t)(" + source + " & " + std::to_string((1 << nets.size()) - 1) + ")";
+            }
+            int constant = 0;
+            std::string packed;
+            for (size_t bit = 0; bit < nets.size(); bit++){
+                if (nets[bit] == CONST_TRUE)    constant |= 1 << bit;
+                if (nets[bit] <= CONST_TRUE)    continue;
+                if (!packed.empty())    packed += " | ";
+                packed += bit ? ref(nets[bit]) + " << " + std::to_string(bit) : ref(nets[bit]);
+            }
+            if (packed.empty())     return std::to_string(constant);
+            if (constant)           packed += " | " + std::to_string(constant);
+            return "(uint16_t)(" + packed + ")";
+        }
+
+        static std::string pinType(const topPin& pin){
+            return pin.nets.size() == 1 ? "bool" : "uint16_t";
+        }
+
+        int gates(){
+            int count = 0;
+            for (int net : m_order){
+                if (net >= 0 && (m_drivers[net].kind == NAND || m_drivers[net].kind == NOT))     ++count;
+            }
+            return count;
+        }
+};
+
+int main(int argc, char* argv[]){
+    std::string output, native = DEFAULT_NATIVE;
+    bool verify = false;
+    long long vectors = VERIFY_VECTORS;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--native" && i + 1 < argc)         native = argv[++i];     // chips run natively, comma separated, or none
+        else if (flag == "--verify")                    verify = true;          // checks the top chip against its native version
+        else if (flag == "--vectors" && i + 1 < argc)   vectors = std::stoll(argv[++i]);
+        else if (flag.substr(0, 2) != "--" && output.empty())   output = flag;
+        else                                            argc = 0;
+    }
+    if (argc < 2 || output.empty() != verify){      // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    std::vector<std::string> natives;
+    std::stringstream list(native);
+    for (std::string name; std::getline(list, name, ',');){
+        if (!name.empty() && name != "none")    natives.push_back(name);
+    }
+    hdlCompiler compiler(argv[1], natives);
+    compiler.flatten();
+    compiler.schedule();
+    compiler.printSummary();
+    if (verify)     return compiler.verify(vectors) ? 0 : 1;
+    compiler.write(output);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <algorithm>
+#include <unordered_map>
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <tuple>
+
+#include "trace.h"
+
+// Runs a program on Computer.hdl as compiled by Tools/hdlc and on the emulator side by side, checking
+// every cycle that both fetch from the same address and write the same word to the same place, then
+// times each of them on their own:
+//
+//      hdlc "Project 5/Computer.hdl" computer_gates.h
+//      g++ -O2 -std=c++17 -I Tools -DHDL_MODEL='"computer_gates.h"' Tools/hdlcheck.cpp -o hdlcheck
+//      hdlcheck Prog.hack [--cycles N]
+//
+// RAM16K has to be native in the model, as it is by default; what else is native is up to hdlc --native.
+
+#ifndef HDL_MODEL
+#define HDL_MODEL "computer_gates.h"
+#endif
+#include HDL_MODEL
+
+#define main emulator_main
+namespace emu {
+#include "emulator.cpp"
+}
+#undef main
+
+#define CHECK_CYCLES (10000000LL)       // cycles compared by default, unless the program halts first
+#define DIFFERENCE_REPORTS (10)         // RAM words printed when the two disagree at the end
+
+struct writeObserver{
+    void onJump(uint16_t, uint16_t){}
+    void onCycle(uint16_t pc){ m_pc = pc; }
+    void onWrite(uint16_t address){ m_write = address; }
+
+    uint16_t    m_pc = 0;
+    int         m_write = -1;
+};
+
+std::vector<uint16_t> loadWords(const std::string& filename){
+    std::ifstream infile(filename);
+    if (!infile.is_open()){
+        std::cout << "cannot open " << filename << "\n";
+        std::exit(1);
+    }
+    std::vector<uint16_t> words;
+    std::string line;
+    while (std::getline(infile, line)){
+        if (line.size() >= 16)      words.push_back(std::stoi(line.substr(0, 16), nullptr, 2));
+    }
+    if (words.size() > 32768){
+        std::cout << filename << " does not fit in ROM" << "\n";
+        std::exit(1);
+    }
+    return words;
+}
+
+std::unique_ptr<hdlModel> loadModel(const std::vector<uint16_t>& words){
+    std::unique_ptr<hdlModel> model(new hdlModel());
+    std::copy(words.begin(), words.end(), model->rom32k0.words);
+    return model;
+}
+
+// the word the gates wrote this cycle as an emulator address, or -1; the inputs of RAM16K and Screen
+// are in, load and address
+int gateWrite(const hdlModel& model, uint16_t& value){
+    if (model.ram16k0_in[1]){
+        value = model.ram16k0_in[0];
+        return model.ram16k0_in[2];
+    }
+    if (model.screen0_in[1]){
+        value = model.screen0_in[0];
+        return SCREEN + model.screen0_in[2];
+    }
+    return -1;
+}
+
+// both models one cycle at a time; the number of cycles that agreed, or -1 after reporting a difference
+long long lockstep(const std::vector<uint16_t>& words, const std::vector<emu::instruction>& rom, long long max_cycles){
+    std::unique_ptr<hdlModel> model = loadModel(words);
+    emu::hackMachine machine(rom);
+    writeObserver observer;
+    long long cycles = 0;
+    while (cycles < max_cycles){
+        observer.m_write = -1;
+        if (machine.run(1, observer) == 0)  break;
+        model->cycle();
+        uint16_t value = 0;
+        int address = gateWrite(*model, value);
+        int expected = observer.m_write < KBD ? observer.m_write : -1;     // the keyboard ignores writes
+        bool same = model->rom32k0_in[0] == observer.m_pc && address == expected;
+        if (same && address >= 0)   same = value == (uint16_t)machine.ram(address);
+        if (!same){
+            std::cout << "cycle " << cycles << ": the emulator ran " << observer.m_pc << " and the gates ran " << model->rom32k0_in[0] << "\n";
+            std::cout << "    the emulator wrote " << (expected < 0 ? std::string("nothing") : std::to_string((uint16_t)machine.ram(expected)) + " to " + std::to_string(expected))
+                      << ", the gates " << (address < 0 ? std::string("nothing") : std::to_string(value) + " to " + std::to_string(address)) << "\n";
+            return -1;
+        }
+        ++cycles;
+    }
+
+    int differences = 0;
+    for (int address = 0; address < KBD; address++){
+        uint16_t word = address < SCREEN ? model->ram16k0.words[address] : model->screen0.words[address - SCREEN];
+        if (word == (uint16_t)machine.ram(address))     continue;
+        if (++differences <= DIFFERENCE_REPORTS)  std::cout << "RAM[" << address << "]: emulator " << (uint16_t)machine.ram(address) << ", gates " << word << "\n";
+    }
+    if (differences){
+        std::cout << differences << " words of RAM differ after " << cycles << " cycles" << "\n";
+        return -1;
+    }
+    return cycles;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]){
+    long long max_cycles = CHECK_CYCLES;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--cycles" && i + 1 < argc)     max_cycles = std::stoll(argv[++i]);
+        else                                        argc = 0;
+    }
+    if (argc < 2){      // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    std::vector<uint16_t> words = loadWords(argv[1]);
+    std::vector<emu::instruction> rom = emu::loadRom(argv[1]);
+    long long cycles = lockstep(words, rom, max_cycles);
+    if (cycles < 0)     return 1;
+    std::cout << cycles << " cycles agree" << "\n";
+    if (cycles == 0)    return 0;
+
+    std::unique_ptr<hdlModel> model = loadModel(words);
+    auto start = std::chrono::steady_clock::now();
+    for (long long i = 0; i < cycles; i++)  model->cycle();
+    double gate_seconds = secondsSince(start);
+
+    emu::hackMachine machine(rom);
+    emu::noObserver observer;
+    start = std::chrono::steady_clock::now();
+    machine.run(cycles, observer);
+    double emulator_seconds = secondsSince(start);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "gates:    " << cycles / gate_seconds / 1e6 << "M cycles/s" << "\n"
+              << "emulator: " << cycles / emulator_seconds / 1e6 << "M cycles/s (" << gate_seconds / emulator_seconds << "x faster)" << "\n";
+    return 0;
+}
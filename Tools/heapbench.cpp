@@ -0,0 +1,411 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <stdlib.h>
+#include <ctype.h>
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <string_view>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <tuple>
+
+#include "trace.h"
+
+// Builds allocation heavy Jack programs against two Memory classes, the first fit allocator of the Jack
+// OS and the size class one in Tools/heap/Memory.jack, and runs each on the emulator:
+//
+//      heapbench <directory> Tools/heap/Memory.jack [scale]
+//
+// Every workload tags the blocks it holds and checks the tags when it frees them, so an allocator that
+// hands out overlapping blocks shows up as errors rather than as a fast run.
+
+#define main compiler_main
+namespace jack {
+#include "../Project 11/compiler.cpp"
+}
+#undef main
+
+#define main translator_main
+namespace vm {
+#include "../Project 8/translator_complete.cpp"
+}
+#undef main
+
+#define main assembler_main
+namespace hack {
+#include "../Project 6/assembler.cpp"
+}
+#undef main
+
+#define main emulator_main
+namespace emu {
+#include "emulator.cpp"
+}
+#undef main
+
+namespace fs = std::filesystem;
+
+#define ITERATIONS (400)        // per workload and unit of scale
+#define MAX_CYCLES (2000000000LL)
+#define SLICE_CYCLES (1000000)  // between looks at the error code, as Sys.error spins rather than halts
+#define RESULT_BASE (24000)     // allocations, tag errors and Sys.error code, in screen memory clear of any heap
+
+// the Jack OS allocator, as the emulator models it natively: segments with a [size, next] header, first
+// fit, blocks carved off the end of a segment, freed blocks pushed on the list and never merged. The
+// heap layout is the native one word for word, so emulator --validate finds no Memory mismatches
+const char* first_fit_memory = R"(class Memory {
+    static Array ram;
+
+    function void init() {
+        let ram = 0;
+        let ram[2048] = 0;
+        let ram[2049] = 2050;
+        let ram[2050] = 14332;
+        let ram[2051] = 0;
+        return;
+    }
+
+    function int peek(int address) {
+        return ram[address];
+    }
+
+    function void poke(int address, int value) {
+        let ram[address] = value;
+        return;
+    }
+
+    function int alloc(int size) {
+        var int previous, segment, block;
+        if (size < 1) {
+            do Sys.error(5);
+        }
+        let previous = 2048;
+        let segment = ram[2049];
+        while (~(segment = 0)) {
+            if (ram[segment] > (size + 1)) {
+                let ram[segment] = ram[segment] - size - 2;
+                let block = segment + 2 + ram[segment];
+                let ram[block] = size;
+                let ram[block + 1] = 0;
+                return block + 2;
+            }
+            if (~(ram[segment] < size)) {
+                let ram[previous + 1] = ram[segment + 1];
+                return segment + 2;
+            }
+            let previous = segment;
+            let segment = ram[segment + 1];
+        }
+        do Sys.error(6);
+        return 0;
+    }
+
+    function void deAlloc(Array object) {
+        let ram[object - 1] = ram[2049];
+        let ram[2049] = object - 2;
+        return;
+    }
+}
+)";
+
+const char* workload_sys = R"(class Sys {
+    function void init() {
+        do Memory.init();
+        do Main.main();
+        return;
+    }
+
+    function void error(int code) {
+        do Main.finish();
+        do Memory.poke(24002, code);
+        while (true) {
+        }
+        return;
+    }
+}
+)";
+
+// the shared start of every Main: blocks are tagged with their size in the first and last word
+const char* workload_helpers = R"(class Main {
+    static int allocations, errors;
+
+    function Array take(int size) {
+        var Array block;
+        let block = Memory.alloc(size);
+        let block[0] = size;
+        let block[size - 1] = size;
+        let allocations = allocations + 1;
+        return block;
+    }
+
+    function void give(Array block, int size) {
+        if (~(block[0] = size) | ~(block[size - 1] = size)) {
+            let errors = errors + 1;
+        }
+        do Memory.deAlloc(block);
+        return;
+    }
+
+    function void finish() {
+        do Memory.poke(24000, allocations);
+        do Memory.poke(24001, errors);
+        return;
+    }
+)";
+
+struct workload{
+    const char*         name;
+    const char*         main;       // Main.main and the end of the class; %N is the iteration count
+};
+
+const workload workloads[] = {
+    // constructor churn: a burst of small objects freed in reverse, as a temporary object graph would be
+    {"objects", R"(
+    function void main() {
+        var Array live;
+        var int i, k, size;
+        let live = Memory.alloc(32);
+        let i = 0;
+        while (i < %N) {
+            let k = 0;
+            let size = 2;
+            while (k < 32) {
+                let live[k] = Main.take(size);
+                let size = size + 1;
+                if (size > 5) {
+                    let size = 2;
+                }
+                let k = k + 1;
+            }
+            while (k > 0) {
+                let k = k - 1;
+                let size = size - 1;
+                if (size < 2) {
+                    let size = 5;
+                }
+                do Main.give(live[k], size);
+            }
+            let i = i + 1;
+        }
+        do Main.finish();
+        return;
+    }
+}
+)"},
+    // string literals: String.new allocates the object and then its characters, and most die young
+    {"strings", R"(
+    function void main() {
+        var Array objects, chars, lengths;
+        var int i, k, length;
+        let objects = Memory.alloc(16);
+        let chars = Memory.alloc(16);
+        let lengths = Memory.alloc(16);
+        let length = 1;
+        let i = 0;
+        while (i < %N) {
+            let k = 0;
+            while (k < 16) {
+                if (i > 0) {
+                    do Main.give(objects[k], 3);
+                    do Main.give(chars[k], lengths[k]);
+                }
+                let objects[k] = Main.take(3);
+                let chars[k] = Main.take(length);
+                let lengths[k] = length;
+                let length = length + 3;
+                if (length > 20) {
+                    let length = length - 19;
+                }
+                let k = k + 1;
+            }
+            let i = i + 1;
+        }
+        do Main.finish();
+        return;
+    }
+}
+)"},
+    // long lived blocks of mixed sizes replaced oldest first, which fragments a first fit heap
+    {"fragment", R"(
+    function void main() {
+        var Array live, sizes;
+        var int i, k, size;
+        let live = Memory.alloc(64);
+        let sizes = Memory.alloc(64);
+        let size = 1;
+        let k = 0;
+        while (k < 64) {
+            let live[k] = Main.take(size);
+            let sizes[k] = size;
+            let size = size + 7;
+            if (size > 24) {
+                let size = size - 24;
+            }
+            let k = k + 1;
+        }
+        let i = 0;
+        while (i < %N) {
+            let k = 0;
+            while (k < 64) {
+                do Main.give(live[k], sizes[k]);
+                let live[k] = Main.take(size);
+                let sizes[k] = size;
+                let size = size + 7;
+                if (size > 24) {
+                    let size = size - 24;
+                }
+                let k = k + 1;
+            }
+            let i = i + 1;
+        }
+        do Main.finish();
+        return;
+    }
+}
+)"},
+};
+
+struct heapResult{
+    long long           cycles;
+    long long           heap_cycles;    // inside Memory.alloc, Memory.deAlloc and their helpers
+    int                 allocations;
+    int                 errors;
+    int                 error_code;     // of Sys.error, 0 if none
+    bool                halted;
+};
+
+struct heapObserver{     // counts the cycles spent in ROM marked as the allocator's
+    const std::vector<bool>&    in_heap;
+    long long                   cycles = 0;
+
+    void onJump(uint16_t, uint16_t){}
+    void onCycle(uint16_t pc){
+        if (in_heap[pc])    ++cycles;
+    }
+    void onWrite(uint16_t){}
+};
+
+// the ROM of every Memory function but peek and poke, from its label in the asm up to the next function's
+std::vector<bool> heapRom(const std::string& asm_file, size_t rom_size){
+    std::vector<bool> in_heap(rom_size, false);
+    std::ifstream infile(asm_file);
+    std::string line;
+    size_t address = 0;
+    bool inside = false;
+    while (std::getline(infile, line)){
+        line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+        if (line.empty() || line.rfind("//", 0) == 0)   continue;
+        if (line[0] == '(' && line.find('$') == std::string::npos && line != "(END)"){
+            std::string function = line.substr(1, line.size() - 2);
+            inside = function.rfind("Memory.", 0) == 0 && function != "Memory.peek" && function != "Memory.poke";
+        }
+        else if (line[0] != '('){
+            if (inside && address < rom_size)    in_heap[address] = true;
+            ++address;
+        }
+    }
+    return in_heap;
+}
+
+class heapBench{
+    public:
+        heapBench(const std::string& directory, const std::string& allocator, int scale)
+            : m_directory(fs::absolute(directory).string()), m_allocator(jack::readFile(allocator)), m_scale(scale){}
+
+        void run(){
+            jack::initKeywordMap();
+            std::cout << std::left << std::setw(12) << "workload" << std::setw(14) << "allocator" << std::right
+                      << std::setw(14) << "cycles" << std::setw(14) << "heap cycles" << std::setw(10) << "allocs"
+                      << std::setw(12) << "heap/alloc"
+                      << std::setw(8) << "errors" << "\n";
+            for (const workload& work : workloads){
+                heapResult first_fit = build(work, "firstfit", first_fit_memory);
+                heapResult size_classes = build(work, "sizeclass", m_allocator);
+                report(work.name, "first fit", first_fit);
+                report(work.name, "size classes", size_classes);
+                std::cout << std::left << std::setw(12) << work.name << std::setw(14) << "speedup" << std::right << std::setw(14);
+                if (completed(first_fit) && completed(size_classes)){    // whole runs only compare if both got through
+                    std::cout << std::fixed << std::setprecision(2) << (double)first_fit.cycles / size_classes.cycles;
+                }
+                else    std::cout << "-";
+                std::cout << std::setw(14) << std::fixed << std::setprecision(2) << perAlloc(first_fit) / perAlloc(size_classes) << "\n";
+            }
+        }
+
+    private:
+        heapResult build(const workload& work, const std::string& variant, const std::string& memory){
+            std::string directory = m_directory + "/" + work.name + "_" + variant;
+            fs::create_directories(directory);
+            std::string main = std::string(workload_helpers) + work.main;
+            main.replace(main.find("%N"), 2, std::to_string(ITERATIONS * m_scale));
+            std::ofstream(directory + "/Main.jack") << main;
+            std::ofstream(directory + "/Sys.jack") << workload_sys;
+            std::ofstream(directory + "/Memory.jack") << memory;
+
+            std::streambuf* out = std::cout.rdbuf(nullptr);     // the stages report every file they write
+            jack::compiler(directory + "/", false, false, false);
+            std::string path = directory + "/";
+            std::string asm_file = directory + "/" + fs::path(directory).filename().string() + ".asm";
+            std::vector<char*> argv = {const_cast<char*>("translator"), &path[0], nullptr};
+            vm::translator_main(2, argv.data());
+            argv[1] = &asm_file[0];
+            hack::assembler_main(2, argv.data());
+            std::cout.rdbuf(out);
+
+            std::vector<emu::instruction> rom = emu::loadRom(asm_file.substr(0, asm_file.size() - 4) + ".hack");
+            emu::hackMachine machine(rom);
+            std::vector<bool> in_heap = heapRom(asm_file, rom.size());
+            heapObserver observer{in_heap};
+            while (!machine.halted() && machine.cycles() < MAX_CYCLES && machine.ram(RESULT_BASE + 2) == 0){
+                machine.run(SLICE_CYCLES, observer);
+            }
+            return {machine.cycles(), observer.cycles, machine.ram(RESULT_BASE), machine.ram(RESULT_BASE + 1),
+                    machine.ram(RESULT_BASE + 2), machine.halted()};
+        }
+
+        void report(const std::string& name, const std::string& allocator, const heapResult& result){
+            std::cout << std::left << std::setw(12) << name << std::setw(14) << allocator << std::right
+                      << std::setw(14) << result.cycles << std::setw(14) << result.heap_cycles << std::setw(10) << result.allocations
+                      << std::setw(12) << std::fixed << std::setprecision(1) << perAlloc(result)
+                      << std::setw(8) << result.errors;
+            if (result.error_code != 0)     std::cout << "  Sys.error " << result.error_code;     // 6: heap exhausted
+            else if (!result.halted)        std::cout << "  did not halt";
+            std::cout << "\n";
+        }
+
+        static bool completed(const heapResult& result){
+            return result.halted && result.error_code == 0;
+        }
+
+        static double perAlloc(const heapResult& result){      // heap cycles per alloc and deAlloc pair
+            return (double)result.heap_cycles / std::max(1, result.allocations);
+        }
+
+        std::string         m_directory;
+        std::string         m_allocator;
+        int                 m_scale;
+};
+
+int main(int argc, char* argv[]){
+    if (argc < 3 || argc > 4){      // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+    heapBench bench(argv[1], argv[2], argc == 4 ? std::stoi(argv[3]) : 1);
+    bench.run();
+    return 0;
+}
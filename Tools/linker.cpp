@@ -0,0 +1,175 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <stdlib.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <bitset>
+#include <cstdint>
+
+#include "trace.h"
+
+// Links relocatable objects written by `assembler File.asm --object` into one .hack file. Objects are
+// placed in command line order, so a program split with `translator_complete Dir --split` and linked in
+// the order the translator prints links to the same words as assembling the whole program at once:
+//
+//      linker Prog.hack Dir/_bootstrap.hobj Dir/Main.hobj OS/Math.hobj ... Dir/_end.hobj [--map]
+
+#define OBJECT_MAGIC "HACKOBJ"
+#define ADDRESS_MASK (0x7fff)
+#define VAR_ADDRESS (16)
+#define ROM_SIZE (32768)
+
+struct objectFile{
+    std::string                                     filename;
+    std::vector<uint16_t>                           words;
+    std::vector<std::pair<std::string, int>>        labels;     // name, word offset in the object
+    std::vector<int>                                relative;   // words holding an offset of this object
+    std::vector<std::pair<int, std::string>>        named;      // word, symbol it takes the address of
+    int                                             base = 0;   // ROM address of its first word
+};
+
+void malformed(const std::string& filename){
+    std::cout << filename << " is not a Hack object" << "\n";
+    std::exit(1);
+}
+
+objectFile loadObject(const std::string& filename){
+    TRACE_SCOPE("loadObject");
+    std::ifstream infile(filename);
+    if (!infile){
+        std::cout << "Could not open " << filename << "\n";
+        std::exit(1);
+    }
+    objectFile object;
+    object.filename = filename;
+    std::string magic, word, kind;
+    size_t words = 0, labels = 0, relative = 0, named = 0;
+    if (!(infile >> magic >> words >> labels >> relative >> named) || magic != OBJECT_MAGIC)     malformed(filename);
+    object.words.reserve(words);
+    for (size_t i = 0; i < words; i++){
+        if (!(infile >> word) || word.size() != 16)     malformed(filename);
+        object.words.push_back(std::bitset<16>(word).to_ulong());
+    }
+    for (size_t i = 0; i < labels; i++){
+        std::string name;
+        int offset;
+        if (!(infile >> kind >> name >> offset) || kind != "L")     malformed(filename);
+        object.labels.push_back({name, offset});
+    }
+    for (size_t i = 0; i < relative; i++){
+        int index;
+        if (!(infile >> kind >> index) || kind != "R" || index < 0 || (size_t)index >= words)     malformed(filename);
+        object.relative.push_back(index);
+    }
+    for (size_t i = 0; i < named; i++){
+        int index;
+        std::string name;
+        if (!(infile >> kind >> index >> name) || kind != "S" || index < 0 || (size_t)index >= words)     malformed(filename);
+        object.named.push_back({index, name});
+    }
+    return object;
+}
+
+class linker{
+    public:
+        linker(std::vector<objectFile>& objects) : m_objects(objects){}
+
+        // every label of every object is known before any reference is resolved; the symbols left over
+        // are variables (statics included), numbered from 16 in order of first reference across the
+        // objects, just as the assembler numbers them over the concatenated source
+        void run(){
+            TRACE_SCOPE("linker::run");
+            int address = 0;
+            for (objectFile& object : m_objects){
+                object.base = address;
+                address += object.words.size();
+                for (const auto& label : object.labels){
+                    auto entry = m_labels.insert({label.first, object.base + label.second});
+                    if (!entry.second){     // a later definition wins, as in the assembler
+                        std::cerr << "warning: " << label.first << " defined again in " << object.filename << "\n";
+                        entry.first->second = object.base + label.second;
+                    }
+                }
+            }
+            if (address > ROM_SIZE){
+                std::cout << "program of " << address << " words does not fit in ROM" << "\n";
+                std::exit(1);
+            }
+
+            int var_address = VAR_ADDRESS;
+            for (objectFile& object : m_objects){
+                for (int index : object.relative)   object.words[index] = (object.words[index] + object.base) & ADDRESS_MASK;
+                for (const auto& reference : object.named){
+                    auto label = m_labels.find(reference.second);
+                    if (label != m_labels.end()){
+                        object.words[reference.first] = label->second & ADDRESS_MASK;
+                        continue;
+                    }
+                    auto variable = m_variables.try_emplace(reference.second, var_address);
+                    if (variable.second)    ++var_address;
+                    object.words[reference.first] = variable.first->second & ADDRESS_MASK;
+                }
+            }
+            m_words = address;
+        }
+
+        void write(const std::string& filename){
+            TRACE_SCOPE("linker::write");
+            std::ofstream outfile(filename);
+            char line[17];
+            line[16] = '\n';
+            for (const objectFile& object : m_objects){
+                for (uint16_t word : object.words){
+                    for (int bit = 0; bit < 16; bit++)  line[bit] = '0' + ((word >> (15 - bit)) & 1);
+                    outfile.write(line, sizeof(line));
+                }
+            }
+        }
+
+        void writeMap(const std::string& filename){     // every symbol with its address, labels then variables
+            std::ofstream outfile(filename);
+            for (const auto* symbols : {&m_labels, &m_variables}){
+                std::vector<std::pair<int, std::string>> sorted;
+                for (const auto& symbol : *symbols)     sorted.push_back({symbol.second, symbol.first});
+                std::sort(sorted.begin(), sorted.end());
+                for (const auto& symbol : sorted)       outfile << symbol.first << " " << symbol.second << "\n";
+            }
+        }
+
+        void printSummary(){
+            std::cout << "linked " << m_objects.size() << " objects: " << m_words << " words, "
+                      << m_labels.size() << " labels, " << m_variables.size() << " variables" << "\n";
+        }
+
+    private:
+        std::vector<objectFile>&                    m_objects;
+        std::unordered_map<std::string, int>        m_labels;
+        std::unordered_map<std::string, int>        m_variables;
+        int                                         m_words = 0;
+};
+
+int main(int argc, char* argv[]){
+    bool map = false;
+    std::vector<std::string> filenames;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--map")                    map = true;
+        else if (flag.substr(0, 2) != "--")     filenames.push_back(flag);
+        else                                    argc = 0;
+    }
+    if (argc < 3 || filenames.empty()){     // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    std::vector<objectFile> objects;
+    for (const std::string& filename : filenames)   objects.push_back(loadObject(filename));
+    linker link(objects);
+    link.run();
+    link.write(argv[1]);
+    if (map)    link.writeMap(std::string(argv[1]) + ".map");
+    link.printSummary();
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <stdlib.h>
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <iomanip>
+#include <cstdint>
+#include <functional>
+
+#include "trace.h"
+
+#define main translator_main
+namespace vm {
+#include "../Project 8/translator_complete.cpp"
+}
+#undef main
+
+namespace fs = std::filesystem;
+
+#define STACK_BASE (256)
+#define STACK_END (2048)        // the heap starts here
+#define FRAME_WORDS (5)         // return address, LCL, ARG, THIS and THAT, pushed by every call
+
+enum boundKind{     // how far the figures of a function can be trusted, from best to worst
+    BOUNDED,        // loop free: the cycles are a true worst case
+    LOOPS,          // cycles are for a single pass through each loop
+    EXTERNAL,       // calls outside the program are counted as free
+    RECURSIVE       // on or above a call cycle: the depth has no bound, cycles are for one activation
+};
+
+const char* kindName(boundKind kind){
+    const char* names[] = {"bounded", "per pass", "external", "recursive"};
+    return names[kind];
+}
+
+struct functionInfo{
+    std::string                 name;
+    std::string                 file;
+    int                         locals = 0;
+    std::vector<vm::vmCommand>  body;       // from its function command on
+    std::vector<int>            cost;       // asm instructions of each command, from the translator itself
+    int                         max_stack = 0;      // operand stack above the locals, own commands only
+    int                         depth = 0;          // stack words from LCL up, callees included
+    long long                   cycles = 0;         // function command through return
+    boundKind                   kind = BOUNDED;
+    int                         scc = -1;
+    bool                        analyzed = false;
+};
+
+// static bounds over the VM program and the asm the translator makes of it: the stack depth of every
+// function from the call graph, recursion, and worst case cycles of the loop free parts
+class stackAnalyzer{
+    public:
+        stackAnalyzer(const std::vector<vm::vmFile>& program, const std::unordered_map<std::string, int>& register_args){
+            vm::romCounter counter;
+            vm::CodeWriter writer(&counter);
+            writer.setRegisterFunctions(register_args);
+            writer.writeBootstrap();
+            m_bootstrap_cost = counter.count();
+            for (const vm::vmFile& file : program){
+                writer.setFileName(file.name);
+                functionInfo* current = nullptr;
+                for (const vm::vmCommand& command : file.commands){
+                    int before = counter.count();
+                    vm::writeCommand(writer, command);
+                    if (command.type == vm::C_FUNCTION){
+                        m_index[command.arg1] = m_functions.size();
+                        m_functions.push_back(functionInfo());
+                        current = &m_functions.back();
+                        current->name = command.arg1;
+                        current->file = file.name;
+                        current->locals = std::stoi(command.arg2);
+                    }
+                    if (current == nullptr)     continue;
+                    current->body.push_back(command);
+                    current->cost.push_back(counter.count() - before);
+                }
+            }
+        }
+
+        void run(){
+            findRecursion();
+            for (size_t f = 0; f < m_functions.size(); f++)     analyze(f);
+        }
+
+        // returns false when the program can overflow the stack or has a stack error; strict also fails
+        // on what cannot be bounded
+        bool printReport(bool strict){
+            std::cout << std::left << std::setw(40) << "function" << std::right << std::setw(8) << "locals" << std::setw(8) << "stack"
+                      << std::setw(8) << "depth" << std::setw(12) << "cycles" << "  bound\n";
+            for (const functionInfo& function : m_functions){
+                std::cout << std::left << std::setw(40) << function.name << std::right << std::setw(8) << function.locals
+                          << std::setw(8) << function.max_stack << std::setw(8) << (function.kind == RECURSIVE ? "-" : std::to_string(function.depth))
+                          << std::setw(12) << function.cycles << "  " << kindName(function.kind) << "\n";
+            }
+            std::cout << "\n";
+            for (const std::string& error : m_errors)       std::cout << "error: " << error << "\n";
+            for (const auto& cycle : m_cycles)              std::cout << "recursion: " << cycle << "\n";
+            for (const std::string& callee : m_external)    std::cout << "external: " << callee << "\n";
+
+            bool ok = m_errors.empty();
+            auto entry = m_index.find("Sys.init");
+            if (entry == m_index.end()){    // no bootstrap, so any function may be the one started at SP 256
+                int deepest = -1;
+                for (size_t f = 0; f < m_functions.size(); f++){
+                    if (deepest == -1 || m_functions[f].depth > m_functions[deepest].depth)    deepest = f;
+                }
+                if (deepest != -1){
+                    const functionInfo& function = m_functions[deepest];
+                    int top = STACK_BASE + function.depth;
+                    std::cout << "no Sys.init, deepest " << function.name << ": SP up to " << top;
+                    ok = report(top, function.kind, strict) && ok;
+                }
+                return ok;
+            }
+            const functionInfo& init = m_functions[entry->second];
+            int top = STACK_BASE + FRAME_WORDS + init.depth;
+            std::cout << "Sys.init: SP up to " << STACK_BASE << " + " << FRAME_WORDS << " + " << init.depth << " = " << top;
+            ok = report(top, init.kind, strict) && ok;
+            std::cout << "program: " << m_bootstrap_cost + init.cycles << " cycles (" << kindName(init.kind) << ")\n";
+            return ok;
+        }
+
+    private:
+        bool report(int top, boundKind kind, bool strict){
+            if (kind == RECURSIVE){
+                std::cout << " for one activation of each recursive call, unbounded\n";
+                return !strict;
+            }
+            if (top > STACK_END){
+                std::cout << ", past the stack end at " << STACK_END << " by " << top - STACK_END << " words\n";
+                return false;
+            }
+            std::cout << ", " << STACK_END - top << " words short of the stack end" << (kind == EXTERNAL ? " without external calls" : "") << "\n";
+            return !(strict && kind == EXTERNAL);
+        }
+
+        int callee(const vm::vmCommand& command) const {
+            auto found = m_index.find(command.arg1);
+            return found == m_index.end() ? -1 : found->second;
+        }
+
+        // Tarjan's strongly connected components over the call graph; a component of more than one function,
+        // or a function calling itself, is a recursion
+        void findRecursion(){
+            std::vector<int> low(m_functions.size()), number(m_functions.size(), -1), stack;
+            std::vector<bool> on_stack(m_functions.size(), false);
+            int counter = 0, components = 0;
+            std::function<void(int)> visit = [&](int f){
+                number[f] = low[f] = counter++;
+                stack.push_back(f);
+                on_stack[f] = true;
+                for (const vm::vmCommand& command : m_functions[f].body){
+                    int g = command.type == vm::C_CALL ? callee(command) : -1;
+                    if (g == -1)                continue;
+                    if (number[g] == -1){
+                        visit(g);
+                        low[f] = std::min(low[f], low[g]);
+                    }
+                    else if (on_stack[g])       low[f] = std::min(low[f], number[g]);
+                }
+                if (low[f] != number[f])    return;
+                std::vector<int> component;
+                int g;
+                do {
+                    g = stack.back();
+                    stack.pop_back();
+                    on_stack[g] = false;
+                    m_functions[g].scc = components;
+                    component.push_back(g);
+                } while (g != f);
+                ++components;
+                bool recursive = component.size() > 1;
+                for (const vm::vmCommand& command : m_functions[f].body){
+                    if (command.type == vm::C_CALL && callee(command) == f)     recursive = true;
+                }
+                if (!recursive)     return;
+                std::string names;
+                for (int member : component){
+                    names += (names.empty() ? "" : ", ") + m_functions[member].name;
+                    m_functions[member].kind = RECURSIVE;
+                }
+                m_cycles.push_back(names);
+            };
+            for (size_t f = 0; f < m_functions.size(); f++){
+                if (number[f] == -1)    visit(f);
+            }
+        }
+
+        void analyze(int f){
+            functionInfo& function = m_functions[f];
+            if (function.analyzed)  return;
+            function.analyzed = true;
+            const std::vector<vm::vmCommand>& body = function.body;
+            int n = body.size();
+
+            std::unordered_map<std::string, int> labels;
+            for (int i = 0; i < n; i++){
+                if (body[i].type == vm::C_LABEL)    labels[body[i].arg1] = i;
+            }
+            std::vector<std::vector<int>> successors(n);
+            for (int i = 0; i < n; i++){
+                const vm::vmCommand& command = body[i];
+                if (command.type == vm::C_GOTO || command.type == vm::C_IF_GOTO){
+                    auto label = labels.find(command.arg1);
+                    if (label == labels.end())  m_errors.push_back(function.name + " jumps to unknown label " + command.arg1);
+                    else                        successors[i].push_back(label->second);
+                }
+                if (command.type != vm::C_GOTO && command.type != vm::C_RETURN && i + 1 < n)    successors[i].push_back(i + 1);
+            }
+
+            // callees first, so their depth and cycles are known; calls within the component are recursion
+            std::vector<long long> call_cycles(n, 0);
+            std::vector<int> call_depth(n, 0);
+            for (int i = 0; i < n; i++){
+                if (body[i].type != vm::C_CALL)     continue;
+                int g = callee(body[i]);
+                if (g == -1){
+                    m_external.insert(body[i].arg1);
+                    function.kind = std::max(function.kind, EXTERNAL);
+                    continue;
+                }
+                if (m_functions[g].scc == function.scc)     continue;
+                analyze(g);
+                call_cycles[i] = m_functions[g].cycles;
+                call_depth[i] = FRAME_WORDS + m_functions[g].depth;
+                function.kind = std::max(function.kind, m_functions[g].kind);
+            }
+
+            // operand stack height before each command, which has to agree wherever paths join
+            std::vector<int> height(n, -1);
+            std::vector<int> pending = {0};
+            height[0] = 0;
+            int peak = 0;
+            while (!pending.empty()){
+                int i = pending.back();
+                pending.pop_back();
+                const vm::vmCommand& command = body[i];
+                int needed = 0, after = height[i];
+                if (command.type == vm::C_PUSH)             after += 1;
+                else if (command.type == vm::C_POP)         needed = 1, after -= 1;
+                else if (command.type == vm::C_IF_GOTO)     needed = 1, after -= 1;
+                else if (command.type == vm::C_RETURN)      needed = 1;
+                else if (command.type == vm::C_ARITHMETIC){
+                    bool unary = command.arg1 == "neg" || command.arg1 == "not";
+                    needed = unary ? 1 : 2;
+                    after -= unary ? 0 : 1;
+                }
+                else if (command.type == vm::C_CALL){
+                    needed = std::stoi(command.arg2);
+                    after += 1 - needed;
+                    peak = std::max(peak, height[i] + call_depth[i]);
+                }
+                if (height[i] < needed){
+                    m_errors.push_back(function.name + " pops below its frame at " + function.file + " line " + std::to_string(command.line));
+                    continue;
+                }
+                function.max_stack = std::max(function.max_stack, std::max(height[i], after));
+                for (int next : successors[i]){
+                    if (height[next] == -1){
+                        height[next] = after;
+                        pending.push_back(next);
+                    }
+                    else if (height[next] != after){
+                        m_errors.push_back(function.name + " reaches " + function.file + " line " + std::to_string(body[next].line)
+                                           + " with stack heights " + std::to_string(height[next]) + " and " + std::to_string(after));
+                    }
+                }
+            }
+            function.depth = function.locals + std::max(function.max_stack, peak);
+
+            // longest path through the commands in depth first post order; an edge back to a command still on
+            // the depth first stack closes a loop and is left out, so each loop counts for one pass
+            std::vector<int> state(n, 0), order;
+            std::set<std::pair<int, int>> back_edges;
+            std::vector<std::pair<int, size_t>> stack = {{0, 0}};
+            state[0] = 1;
+            while (!stack.empty()){
+                int node = stack.back().first;
+                size_t& next = stack.back().second;
+                if (next < successors[node].size()){
+                    int successor = successors[node][next++];
+                    if (state[successor] == 1)      back_edges.insert({node, successor});
+                    else if (state[successor] == 0){
+                        state[successor] = 1;
+                        stack.push_back({successor, 0});
+                    }
+                    continue;
+                }
+                state[node] = 2;
+                order.push_back(node);
+                stack.pop_back();
+            }
+            if (!back_edges.empty())    function.kind = std::max(function.kind, LOOPS);
+            std::vector<long long> longest(n, 0);
+            for (int node : order){
+                long long tail = 0;
+                for (int successor : successors[node]){
+                    if (back_edges.count({node, successor}) == 0)   tail = std::max(tail, longest[successor]);
+                }
+                longest[node] = function.cost[node] + call_cycles[node] + tail;
+            }
+            function.cycles = longest[0];
+        }
+
+        std::vector<functionInfo>                   m_functions;
+        std::unordered_map<std::string, int>        m_index;
+        int                                         m_bootstrap_cost = 0;
+        std::vector<std::string>                    m_errors;
+        std::vector<std::string>                    m_cycles;       // members of each recursion
+        std::set<std::string>                       m_external;
+};
+
+std::vector<vm::vmFile> loadProgram(const std::string& path){
+    std::vector<std::string> filenames;
+    if (path.substr(path.size() - 3, 3) == ".vm")   filenames.push_back(path);
+    else {
+        for (const auto& fpath : fs::directory_iterator(path)){
+            if (fpath.path().extension() == ".vm")  filenames.push_back(fpath.path());
+        }
+        std::sort(filenames.begin(), filenames.end());
+    }
+    std::vector<vm::vmFile> program;
+    for (const std::string& fname : filenames){
+        vm::Parser parser(fname);
+        vm::vmFile file;
+        file.name = vm::getFilenameFromPath(fname);
+        while (parser.hasMoreLines()){
+            parser.parse();
+            if (parser.commandType() != vm::INVALID){
+                file.commands.push_back({parser.commandType(), parser.arg1(), parser.arg2(), parser.lineNumber()});
+            }
+        }
+        program.push_back(file);
+    }
+    return program;
+}
+
+int main(int argc, char* argv[]){
+    bool registers = false, strict = false;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--registers")      registers = true;     // costs as translated with --registers
+        else if (flag == "--strict")    strict = true;        // recursion and external calls fail the check too
+        else                            argc = 0;
+    }
+    if (argc < 2){      // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    vm::initCommandTable();
+    std::vector<vm::vmFile> program = loadProgram(argv[1]);
+    std::unordered_map<std::string, int> register_args;
+    if (registers){
+        vm::CallGraph call_graph(program);
+        register_args = call_graph.registerFunctions();
+    }
+    stackAnalyzer analyzer(program, register_args);
+    analyzer.run();
+    return analyzer.printReport(strict) ? 0 : 1;
+}
@@ -0,0 +1,398 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <stdlib.h>
+#include <ctype.h>
+#include <cctype>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sstream>
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <string_view>
+#include <bitset>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// the stages are the standalone tools themselves, each kept in its own namespace
+#define main compiler_main
+namespace jack {
+#include "../Project 11/compiler.cpp"
+}
+#undef main
+
+#define main translator_main
+namespace vm {
+#include "../Project 8/translator_complete.cpp"
+}
+#undef main
+
+#define main assembler_main
+namespace hack {
+#include "../Project 6/assembler.cpp"
+}
+#undef main
+
+namespace fs = std::filesystem;
+
+#define WATCH_SETTLE_MS (10)    // events arriving this close together are folded into one rebuild
+#define STREAM_QUEUE_SIZE (64)  // blocks in flight between two streaming stages, which bounds their memory
+
+struct classState{
+    uint64_t            hash;       // of the .jack source last compiled
+    vm::vmFile          ir;
+    std::string         fragment;   // asm of the class
+};
+
+class stageTimer{
+    public:
+        stageTimer() : m_start(std::chrono::steady_clock::now()){}
+
+        double lap(){   // milliseconds since the last lap
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double, std::milli>(now - m_start).count();
+            m_start = now;
+            return elapsed;
+        }
+
+    private:
+        std::chrono::steady_clock::time_point   m_start;
+};
+
+vm::vmCommand toTranslator(const jack::vmCommand& command){   // compiler record to translator record, no text in between
+    switch (command.op)
+    {
+        case jack::VM_PUSH:         return {vm::C_PUSH, command.arg1, std::to_string(command.arg2)};
+        case jack::VM_POP:          return {vm::C_POP, command.arg1, std::to_string(command.arg2)};
+        case jack::VM_ARITHMETIC:   return {vm::C_ARITHMETIC, command.arg1, ""};
+        case jack::VM_LABEL:        return {vm::C_LABEL, command.arg1, ""};
+        case jack::VM_GOTO:         return {vm::C_GOTO, command.arg1, ""};
+        case jack::VM_IF:           return {vm::C_IF_GOTO, command.arg1, ""};
+        case jack::VM_CALL:         return {vm::C_CALL, command.arg1, std::to_string(command.arg2)};
+        case jack::VM_FUNCTION:     return {vm::C_FUNCTION, command.arg1, std::to_string(command.arg2)};
+        default:                    return {vm::C_RETURN, "", ""};
+    }
+}
+
+template <typename T, size_t N>
+class boundedQueue{     // lock-free single producer, single consumer ring; both sides yield while it is full or empty
+    public:
+        void push(T&& item){
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            while (tail - m_head.load(std::memory_order_acquire) == N)     std::this_thread::yield();
+            m_items[tail % N] = std::move(item);
+            m_tail.store(tail + 1, std::memory_order_release);
+        }
+
+        T pop(){
+            size_t head = m_head.load(std::memory_order_relaxed);
+            while (m_tail.load(std::memory_order_acquire) == head)         std::this_thread::yield();
+            T item = std::move(m_items[head % N]);
+            m_head.store(head + 1, std::memory_order_release);
+            return item;
+        }
+
+    private:
+        T                       m_items[N];
+        std::atomic<size_t>     m_head{0};
+        std::atomic<size_t>     m_tail{0};
+};
+
+struct streamBlock{
+    std::string                 file;       // .vm file name the block belongs to, empty for the end of the stream
+    std::vector<vm::vmCommand>  commands;
+    std::string                 text;       // asm, once translated
+};
+
+class toolchain{    // Jack directory to a single .hack, keeping per-class results warm between builds
+    public:
+        toolchain(const std::string& directory, bool dump) : m_directory(directory), m_dump(dump){
+            if (m_directory.back() != '/')      m_directory += "/";
+            m_name = fs::canonical(m_directory).filename().string();
+        }
+
+        bool build(){      // false when a class does not compile, leaving the last .hack in place
+            stageTimer timer;
+            int compiled = 0;
+            std::unordered_set<std::string> present;
+            for (const auto& fpath : fs::directory_iterator(m_directory)){
+                if (fpath.path().extension() != ".jack")    continue;
+                std::string fname = fpath.path().string();
+                present.insert(fname);
+                uint64_t hash = jack::contentHash(jack::readFile(fname));
+                auto state = m_classes.find(fname);
+                if (state != m_classes.end() && state->second.hash == hash)     continue;
+                try {
+                    compileClass(fname, hash);
+                }
+                catch (const std::runtime_error& error){
+                    std::cout << error.what() << std::endl;
+                    return false;
+                }
+                ++compiled;
+            }
+            for (auto state = m_classes.begin(); state != m_classes.end();){
+                if (present.count(state->first) == 0)   state = m_classes.erase(state);
+                else                                    ++state;
+            }
+            double compile_ms = timer.lap();
+
+            for (auto& state : m_classes){
+                if (!state.second.fragment.empty())     continue;
+                std::stringbuf buffer;
+                vm::CodeWriter writer(&buffer);
+                vm::writeFile(writer, state.second.ir);
+                state.second.fragment = buffer.str();
+            }
+            hack::Encoder encoder;
+            {
+                std::stringbuf bootstrap, closing;
+                std::vector<vm::vmFile> program;
+                for (const auto& state : m_classes)     program.push_back(state.second.ir);
+                if (vm::definesFunction(program, "Sys.init")){
+                    vm::CodeWriter writer(&bootstrap);
+                    writer.writeBootstrap();
+                }
+                vm::CodeWriter writer(&closing);
+                writer.writeClosing();
+                addLines(encoder, bootstrap.str());
+                for (const auto& state : m_classes)     addLines(encoder, state.second.fragment);
+                addLines(encoder, closing.str());
+                if (m_dump){
+                    std::ofstream outfile(m_directory + m_name + ".asm");
+                    outfile << bootstrap.str();
+                    for (const auto& state : m_classes)     outfile << state.second.fragment;
+                    outfile << closing.str();
+                }
+            }
+            double translate_ms = timer.lap();
+
+            const std::vector<uint16_t>& words = encoder.finish();
+            std::ofstream outfile(m_directory + m_name + ".hack");
+            for (uint16_t word : words)     outfile << std::bitset<16>(word) << "\n";
+            outfile.close();
+            double assemble_ms = timer.lap();
+
+            std::cout << "compiled " << compiled << "/" << m_classes.size() << " classes"
+                      << "  compile " << compile_ms << "ms"
+                      << "  translate " << translate_ms << "ms"
+                      << "  assemble " << assemble_ms << "ms"
+                      << "  total " << compile_ms + translate_ms + assemble_ms << "ms" << std::endl;
+            return true;
+        }
+
+        // compiler, translator and encoder run on their own threads, one subroutine at a time
+        bool stream(){
+            stageTimer timer;
+            boundedQueue<streamBlock, STREAM_QUEUE_SIZE> vm_queue, asm_queue;
+            double busy_ms[3] = {0, 0, 0};
+            std::vector<std::string> filenames;
+            for (const auto& fpath : fs::directory_iterator(m_directory)){
+                if (fpath.path().extension() == ".jack")    filenames.push_back(fpath.path().string());
+            }
+            std::sort(filenames.begin(), filenames.end());
+
+            std::string error;      // set by the compiler thread, which still ends the stream so the others finish
+            // as in build(), the bootstrap goes in when some class defines Sys.init; the assembler holds
+            // the blocks back until the compiler has seen it or has finished
+            std::atomic<bool> defines_sys_init{false}, compiled{false};
+            std::thread compiler([&](){
+                stageTimer busy;
+                for (const std::string& fname : filenames){
+                    std::string vm_file = vm::getFilenameFromPath(fname.substr(0, fname.size() - 5) + ".vm");
+                    std::ofstream dump;
+                    if (m_dump)     dump.open(fname.substr(0, fname.size() - 5) + ".vm");
+                    jack::compileEngine compile_engine(fname, false, true);
+                    compile_engine.onSubroutine([&](std::vector<jack::vmCommand>&& commands){
+                        streamBlock block;
+                        block.file = vm_file;
+                        for (const jack::vmCommand& command : commands){
+                            if (command.op == jack::VM_FUNCTION && command.arg1 == "Sys.init")    defines_sys_init = true;
+                            if (m_dump)     dump << jack::toString(command) << "\n";
+                            block.commands.push_back(toTranslator(command));
+                        }
+                        busy_ms[0] += busy.lap();
+                        vm_queue.push(std::move(block));
+                        busy.lap();
+                    });
+                    try {
+                        compile_engine.compileClass();
+                    }
+                    catch (const std::runtime_error& thrown){
+                        error = thrown.what();
+                        break;
+                    }
+                }
+                busy_ms[0] += busy.lap();
+                compiled = true;
+                vm_queue.push(streamBlock());
+            });
+
+            std::thread translator([&](){
+                stageTimer busy;
+                std::stringbuf buffer;
+                vm::CodeWriter writer(&buffer);     // one writer throughout, so label counters run on within a file
+                std::string current_file;
+                while (true){
+                    busy.lap();
+                    streamBlock block = vm_queue.pop();
+                    busy.lap();
+                    if (block.file.empty())     writer.writeClosing();
+                    else {
+                        if (block.file != current_file){
+                            writer.setFileName(block.file);
+                            current_file = block.file;
+                        }
+                        for (const vm::vmCommand& command : block.commands)     vm::writeCommand(writer, command);
+                    }
+                    block.text = buffer.str();
+                    buffer.str("");
+                    busy_ms[1] += busy.lap();
+                    bool last = block.file.empty();
+                    asm_queue.push(std::move(block));
+                    if (last)   break;
+                }
+            });
+
+            hack::Encoder encoder;
+            std::thread assembler([&](){
+                stageTimer busy;
+                std::ofstream dump;
+                if (m_dump)     dump.open(m_directory + m_name + ".asm");
+                std::vector<streamBlock> held;
+                bool started = false;
+                while (true){
+                    busy.lap();
+                    held.push_back(asm_queue.pop());
+                    busy.lap();
+                    if (!started && !defines_sys_init && !compiled)     continue;
+                    if (!started && defines_sys_init){
+                        std::stringbuf bootstrap;
+                        vm::CodeWriter writer(&bootstrap);
+                        writer.writeBootstrap();
+                        held.insert(held.begin(), streamBlock{"bootstrap", {}, bootstrap.str()});
+                    }
+                    started = true;
+                    for (const streamBlock& block : held){
+                        addLines(encoder, block.text);
+                        if (m_dump)     dump << block.text;
+                    }
+                    busy_ms[2] += busy.lap();
+                    if (held.back().file.empty())   break;
+                    held.clear();
+                }
+            });
+
+            compiler.join();
+            translator.join();
+            assembler.join();
+            if (!error.empty()){
+                std::cout << error << std::endl;
+                return false;
+            }
+            stageTimer finish;
+            const std::vector<uint16_t>& words = encoder.finish();
+            std::ofstream outfile(m_directory + m_name + ".hack");
+            for (uint16_t word : words)     outfile << std::bitset<16>(word) << "\n";
+            outfile.close();
+            busy_ms[2] += finish.lap();
+
+            std::cout << "streamed " << filenames.size() << " classes"
+                      << "  compile " << busy_ms[0] << "ms"
+                      << "  translate " << busy_ms[1] << "ms"
+                      << "  assemble " << busy_ms[2] << "ms"
+                      << "  wall " << timer.lap() << "ms" << std::endl;
+            return true;
+        }
+
+        void watch(){
+            int fd = inotify_init1(IN_NONBLOCK);
+            if (fd < 0 || inotify_add_watch(fd, m_directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0){
+                std::cout << "cannot watch " << m_directory << "\n";
+                std::exit(1);
+            }
+            build();
+            pollfd pfd{fd, POLLIN, 0};
+            char events[4096];
+            while (poll(&pfd, 1, -1) > 0){
+                bool relevant = false;
+                do {
+                    ssize_t length;
+                    while ((length = read(fd, events, sizeof(events))) > 0){
+                        for (char* event = events; event < events + length; ){
+                            inotify_event* info = reinterpret_cast<inotify_event*>(event);
+                            if (info->len > 0 && fs::path(info->name).extension() == ".jack")     relevant = true;
+                            event += sizeof(inotify_event) + info->len;
+                        }
+                    }
+                }
+                while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0);
+                if (relevant)   build();
+            }
+            close(fd);
+        }
+
+    private:
+        void compileClass(const std::string& fname, uint64_t hash){
+            jack::compileEngine compile_engine(fname, false, true);
+            compile_engine.compileClass();
+            classState state;
+            state.hash = hash;
+            state.ir.name = vm::getFilenameFromPath(fname.substr(0, fname.size() - 5) + ".vm");
+            for (const jack::vmCommand& command : compile_engine.commands()){
+                state.ir.commands.push_back(toTranslator(command));
+            }
+            if (m_dump){
+                std::ofstream outfile(fname.substr(0, fname.size() - 5) + ".vm");
+                for (const jack::vmCommand& command : compile_engine.commands())   outfile << jack::toString(command) << "\n";
+            }
+            m_classes[fname] = state;
+        }
+
+        void addLines(hack::Encoder& encoder, const std::string& text){
+            size_t start = 0, end;
+            while ((end = text.find('\n', start)) != std::string::npos){
+                encoder.addLine(text.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+
+        std::string                             m_directory;
+        std::string                             m_name;
+        bool                                    m_dump;         // also write the intermediate .vm and .asm files
+        std::map<std::string, classState>       m_classes;      // ordered, so the ROM layout is stable across builds
+};
+
+int main(int argc, char* argv[]){
+    bool watch = false, dump = false, stream = false;
+    for (int i = 2; i < argc; i++){
+        std::string flag(argv[i]);
+        if (flag == "--watch")          watch = true;
+        else if (flag == "--stream")    stream = true;
+        else if (flag == "--dump")      dump = true;
+        else                            argc = 0;
+    }
+    if (argc < 2){     // impose correct usage
+        std::cout << "Incorrect usage" << "\n";
+        return 1;
+    }
+
+    jack::initKeywordMap();
+    vm::initCommandTable();
+    toolchain chain(argv[1], dump);
+    if (watch)          chain.watch();
+    else if (stream)    return chain.stream() ? 0 : 1;
+    else                return chain.build() ? 0 : 1;
+    return 0;
+}
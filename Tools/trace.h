@@ -0,0 +1,177 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Hot path instrumentation for the toolchain. Build any tool with -DTRACE to enable it, linking in
+// Tools/alloc_hook.cpp, which counts allocations; otherwise the macros expand to empty statements. On
+// exit a Chrome trace (chrome://tracing, Perfetto) is written to $TRACE_FILE (default trace.json) and a
+// per scope summary table is printed to stderr.
+//
+//      g++ -O2 -std=c++17 -DTRACE "Project 11/compiler.cpp" Tools/alloc_hook.cpp -o compiler
+//
+//      TRACE_SCOPE("Parser::parse");           times the enclosing block
+//      TRACE_COUNT("tokens", 1);               adds to a named counter
+
+#ifdef TRACE
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "alloc_hook.h"
+
+#define TRACE_MAX_EVENTS (1 << 20)  // per thread; past this only the summary keeps counting
+
+namespace trace {
+
+typedef std::chrono::steady_clock clock;
+
+struct event{
+    const char*         name;
+    long long           start_ns;
+    long long           duration_ns;
+};
+
+struct stat{
+    long long           count = 0;
+    long long           total_ns = 0;
+};
+
+struct threadLog{
+    int                                         tid;
+    std::vector<event>                          events;
+    std::unordered_map<const char*, stat>       stats;
+    std::unordered_map<const char*, long long>  counters;
+};
+
+class registry{
+    public:
+        static registry& get(){
+            static registry instance;
+            return instance;
+        }
+
+        ~registry(){
+            exportTrace();
+            printSummary();
+        }
+
+        threadLog& log(){
+            thread_local threadLog* current = nullptr;
+            if (current == nullptr){
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_logs.emplace_back(new threadLog());
+                current = m_logs.back().get();
+                current->tid = m_logs.size();
+            }
+            return *current;
+        }
+
+        long long since(clock::time_point time) const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time - m_origin).count();
+        }
+
+    private:
+        registry() : m_origin(clock::now()){}
+
+        void exportTrace(){
+            const char* filename = std::getenv("TRACE_FILE");
+            std::ofstream outfile(filename != nullptr ? filename : "trace.json");
+            outfile << "{\"traceEvents\": [\n";
+            bool first = true;
+            for (const auto& log : m_logs){
+                for (const event& e : log->events){
+                    outfile << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << log->tid
+                            << ", \"ts\": " << e.start_ns / 1000.0 << ", \"dur\": " << e.duration_ns / 1000.0 << "}";
+                    first = false;
+                }
+            }
+            outfile << "\n], \"otherData\": {";
+            first = true;
+            for (const auto& counter : counters()){
+                outfile << (first ? "" : ", ") << "\"" << counter.first << "\": " << counter.second;
+                first = false;
+            }
+            outfile << "}}\n";
+        }
+
+        std::map<std::string, long long> counters(){
+            std::map<std::string, long long> merged;
+            for (const auto& log : m_logs){
+                for (const auto& counter : log->counters)   merged[counter.first] += counter.second;
+            }
+            merged["allocations"] = alloc_hook::allocations.load();
+            return merged;
+        }
+
+        void printSummary(){
+            std::map<std::string, stat> merged;
+            for (const auto& log : m_logs){
+                for (const auto& s : log->stats){
+                    merged[s.first].count += s.second.count;
+                    merged[s.first].total_ns += s.second.total_ns;
+                }
+            }
+            std::cerr << std::left << std::setw(48) << "scope" << std::right << std::setw(12) << "calls"
+                      << std::setw(14) << "total ms" << std::setw(12) << "avg ns" << "\n";
+            for (const auto& s : merged){
+                std::cerr << std::left << std::setw(48) << s.first << std::right << std::setw(12) << s.second.count
+                          << std::setw(14) << std::fixed << std::setprecision(3) << s.second.total_ns / 1e6
+                          << std::setw(12) << s.second.total_ns / s.second.count << "\n";
+            }
+            for (const auto& counter : counters()){
+                std::cerr << std::left << std::setw(48) << counter.first << std::right << std::setw(12) << counter.second << "\n";
+            }
+        }
+
+        clock::time_point                           m_origin;
+        std::mutex                                  m_mutex;
+        std::vector<std::unique_ptr<threadLog>>     m_logs;
+};
+
+class scope{
+    public:
+        scope(const char* name) : m_name(name){
+            registry::get();    // the first scope fixes the trace origin before it starts timing
+            m_start = clock::now();
+        }
+
+        ~scope(){
+            clock::time_point end = clock::now();
+            registry& r = registry::get();
+            threadLog& log = r.log();
+            long long duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count();
+            stat& s = log.stats[m_name];
+            ++s.count;
+            s.total_ns += duration;
+            if (log.events.size() < TRACE_MAX_EVENTS)     log.events.push_back({m_name, r.since(m_start), duration});
+        }
+
+    private:
+        const char*             m_name;
+        clock::time_point       m_start;
+};
+
+}
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) ::trace::scope TRACE_JOIN(trace_scope_, __LINE__)(name)
+#define TRACE_COUNT(name, n) (::trace::registry::get().log().counters[name] += (n))
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)      // a statement still, so `if (...) TRACE_COUNT(...);` keeps a body
+#define TRACE_COUNT(name, n) do {} while (0)
+
+#endif
+
+#endif